@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/*************************************************************************************/
+
+#define ARCHIVE_BUFFER_SIZE     (4 * 1024 * 1024)
+#define ARCHIVE_RECORD_HEADER_MAX   (PATH_MAX + 512)
+#define ARCHIVE_RECORD_URI_PREFIX   "WARC/1.1\r\nWARC-Type: response\r\nWARC-Target-URI: "
+
+struct archive
+{
+    char* path;
+    int fd;
+
+    char* buf;                      // Pending writes
+    size_t buflen;
+    uint64_t size;                  // Archive size including pending writes
+
+    archive_index_entry_t* entries;
+    size_t nentries;
+    size_t maxentries;
+
+    struct timespec started;        // Seed for record ids
+};
+
+struct archive_reader
+{
+    int fd;
+    const archive_index_header_t* index;
+    size_t index_size;
+};
+
+/*************************************************************************************/
+
+/*
+ * write() that does not give up on partial writes
+ */
+static int write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t res = write(fd, data, size);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        data += res;
+        size -= res;
+    }
+
+    return 0;
+}
+
+static int archive_flush(archive_t* archive)
+{
+    int error = write_all(archive->fd, archive->buf, archive->buflen);
+    if (error) {
+        fprintf(stderr, "Failed to write archive '%s': %s\n", archive->path, strerror(error));
+        return error;
+    }
+
+    archive->buflen = 0;
+    return 0;
+}
+
+/*
+ * Buffered write, chunks larger than buffer go straight to file
+ */
+static int archive_write(archive_t* archive, const char* data, size_t size)
+{
+    int error = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    if (archive->buflen + size > ARCHIVE_BUFFER_SIZE) {
+        error = archive_flush(archive);
+        if (error) {
+            return error;
+        }
+    }
+
+    if (size >= ARCHIVE_BUFFER_SIZE) {
+        error = write_all(archive->fd, data, size);
+        if (error) {
+            fprintf(stderr, "Failed to write archive '%s': %s\n", archive->path, strerror(error));
+            return error;
+        }
+    } else {
+        memcpy(archive->buf + archive->buflen, data, size);
+        archive->buflen += size;
+    }
+
+    archive->size += size;
+    return 0;
+}
+
+static int add_index_entry(archive_t* archive, uint64_t url_hash, uint64_t offset, uint64_t length, uint64_t url_offset)
+{
+    if (archive->nentries == archive->maxentries) {
+        size_t maxentries = (archive->maxentries ? archive->maxentries * 2 : 1024);
+        archive_index_entry_t* entries = realloc(archive->entries, maxentries * sizeof(*entries));
+        if (!entries) {
+            return ENOMEM;
+        }
+
+        archive->entries = entries;
+        archive->maxentries = maxentries;
+    }
+
+    archive_index_entry_t* entry = &archive->entries[archive->nentries++];
+    entry->url_hash = url_hash;
+    entry->offset = offset;
+    entry->length = length;
+    entry->url_offset = url_offset;
+    return 0;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const archive_index_entry_t* ea = a;
+    const archive_index_entry_t* eb = b;
+
+    if (ea->url_hash != eb->url_hash) {
+        return (ea->url_hash < eb->url_hash ? -1 : 1);
+    }
+
+    // Keep records of the same URL in archive order
+    return (ea->offset < eb->offset ? -1 : (ea->offset > eb->offset));
+}
+
+static int write_index(archive_t* archive)
+{
+    int error = 0;
+
+    qsort(archive->entries, archive->nentries, sizeof(*archive->entries), compare_entries);
+
+    char* path = NULL;
+    if (asprintf(&path, "%s%s", archive->path, ARCHIVE_INDEX_SUFFIX) < 0) {
+        return ENOMEM;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = errno;
+        fprintf(stderr, "Could not create archive index '%s': %s\n", path, strerror(error));
+        free(path);
+        return error;
+    }
+
+    archive_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_INDEX_MAGIC, sizeof(header.magic));
+    header.count = archive->nentries;
+
+    error = write_all(fd, (const char*)&header, sizeof(header));
+    if (!error) {
+        error = write_all(fd, (const char*)archive->entries, archive->nentries * sizeof(*archive->entries));
+    }
+
+    if (error) {
+        fprintf(stderr, "Failed to write archive index '%s': %s\n", path, strerror(error));
+    }
+
+    close(fd);
+    free(path);
+    return error;
+}
+
+/*************************************************************************************/
+
+int archive_open(const char* path, archive_t** out_archive)
+{
+    int error = 0;
+
+    if (!path || !out_archive) {
+        return EINVAL;
+    }
+
+    archive_t* archive = calloc(1, sizeof(*archive));
+    if (!archive) {
+        return ENOMEM;
+    }
+
+    archive->fd = -1;
+    clock_gettime(CLOCK_REALTIME, &archive->started);
+
+    archive->path = strdup(path);
+    archive->buf = malloc(ARCHIVE_BUFFER_SIZE);
+    if (!archive->path || !archive->buf) {
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    archive->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (archive->fd < 0) {
+        error = errno;
+        fprintf(stderr, "Could not create archive '%s': %s\n", path, strerror(error));
+        goto error_out;
+    }
+
+    *out_archive = archive;
+    return 0;
+
+error_out:
+    if (archive->fd >= 0) {
+        close(archive->fd);
+    }
+    free(archive->buf);
+    free(archive->path);
+    free(archive);
+    return error;
+}
+
+int archive_append(archive_t* archive, const char* url,
+                   const char* header, size_t header_length,
+                   const char* body, size_t body_length)
+{
+    int error = 0;
+
+    if (!archive || !url || (!header && header_length) || (!body && body_length)) {
+        return EINVAL;
+    }
+
+    uint64_t url_hash = hash_string(url);
+    uint64_t seq = (archive->nentries + 1) * 0x9E3779B97F4A7C15ull ^ (uint64_t)archive->started.tv_nsec;
+
+    char date[32];
+    struct tm tm;
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+
+    char record[ARCHIVE_RECORD_HEADER_MAX];
+    int record_length = snprintf(record, sizeof(record),
+        ARCHIVE_RECORD_URI_PREFIX "%s\r\n"
+        "WARC-Date: %s\r\n"
+        "WARC-Record-ID: <urn:uuid:%08x-%04x-4%03x-%04x-%012llx>\r\n"
+        "Content-Type: application/http;msgtype=response\r\n"
+        "Content-Length: %zu\r\n"
+        "\r\n",
+        url, date,
+        (unsigned)(url_hash >> 32), (unsigned)(url_hash >> 16) & 0xffff, (unsigned)url_hash & 0xfff,
+        ((unsigned)(seq >> 48) & 0x3fff) | 0x8000, (unsigned long long)seq & 0xffffffffffffull,
+        header_length + body_length);
+
+    if (record_length < 0 || (size_t)record_length >= sizeof(record)) {
+        fprintf(stderr, "URL is too long for archive record: %s\n", url);
+        return ENAMETOOLONG;
+    }
+
+    uint64_t url_offset = archive->size + strlen(ARCHIVE_RECORD_URI_PREFIX);
+    error = archive_write(archive, record, record_length);
+    if (!error) {
+        error = archive_write(archive, header, header_length);
+    }
+
+    uint64_t body_offset = archive->size;
+    if (!error) {
+        error = archive_write(archive, body, body_length);
+    }
+
+    if (!error) {
+        error = archive_write(archive, "\r\n\r\n", 4);
+    }
+
+    if (error) {
+        return error;
+    }
+
+    return add_index_entry(archive, url_hash, body_offset, body_length, url_offset);
+}
+
+int archive_close(archive_t* archive)
+{
+    if (!archive) {
+        return EINVAL;
+    }
+
+    int error = archive_flush(archive);
+    if (!error) {
+        error = write_index(archive);
+    }
+
+    if (close(archive->fd) && !error) {
+        error = errno;
+    }
+
+    free(archive->entries);
+    free(archive->buf);
+    free(archive->path);
+    free(archive);
+    return error;
+}
+
+/*************************************************************************************/
+
+int archive_reader_open(const char* path, archive_reader_t** out_reader)
+{
+    int error = 0;
+
+    if (!path || !out_reader) {
+        return EINVAL;
+    }
+
+    archive_reader_t* reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        return ENOMEM;
+    }
+
+    char* index_path = NULL;
+    int index_fd = -1;
+
+    reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (reader->fd < 0) {
+        error = errno;
+        fprintf(stderr, "Could not open archive '%s': %s\n", path, strerror(error));
+        goto error_out;
+    }
+
+    if (asprintf(&index_path, "%s%s", path, ARCHIVE_INDEX_SUFFIX) < 0) {
+        index_path = NULL;
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    index_fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (index_fd < 0 || fstat(index_fd, &st)) {
+        error = errno;
+        fprintf(stderr, "Could not open archive index '%s': %s\n", index_path, strerror(error));
+        goto error_out;
+    }
+
+    if ((size_t)st.st_size < sizeof(archive_index_header_t)) {
+        error = EINVAL;
+        goto malformed;
+    }
+
+    void* index = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, index_fd, 0);
+    if (index == MAP_FAILED) {
+        error = errno;
+        fprintf(stderr, "Could not map archive index '%s': %s\n", index_path, strerror(error));
+        goto error_out;
+    }
+
+    reader->index = index;
+    reader->index_size = st.st_size;
+
+    if (memcmp(reader->index->magic, ARCHIVE_INDEX_MAGIC, sizeof(reader->index->magic)) ||
+        (reader->index->count != (st.st_size - sizeof(archive_index_header_t)) / sizeof(archive_index_entry_t)) ||
+        ((st.st_size - sizeof(archive_index_header_t)) % sizeof(archive_index_entry_t))) {
+        error = EINVAL;
+        goto malformed;
+    }
+
+    close(index_fd);
+    free(index_path);
+
+    *out_reader = reader;
+    return 0;
+
+malformed:
+    fprintf(stderr, "Archive index '%s' is malformed\n", index_path);
+
+error_out:
+    if (index_fd >= 0) {
+        close(index_fd);
+    }
+    free(index_path);
+    archive_reader_close(reader);
+    return error;
+}
+
+void archive_reader_close(archive_reader_t* reader)
+{
+    if (reader)
+    {
+        if (reader->index) {
+            munmap((void*)reader->index, reader->index_size);
+        }
+
+        if (reader->fd >= 0) {
+            close(reader->fd);
+        }
+
+        free(reader);
+    }
+}
+
+/*
+ * Index only holds URL hashes, target URI of the record tells whether entry really is for this URL
+ */
+static bool record_matches(const archive_reader_t* reader, const archive_index_entry_t* entry, const char* url)
+{
+    char uri[ARCHIVE_RECORD_HEADER_MAX];
+    size_t length = strlen(url);
+    if (length + 2 > sizeof(uri)) {
+        return false;
+    }
+
+    ssize_t res = pread(reader->fd, uri, length + 2, entry->url_offset);
+    return (res == (ssize_t)(length + 2) && 0 == memcmp(uri, url, length) && 0 == memcmp(uri + length, "\r\n", 2));
+}
+
+int archive_reader_find(const archive_reader_t* reader, const char* url, uint64_t* out_offset, uint64_t* out_length)
+{
+    if (!reader || !url || !out_offset || !out_length) {
+        return EINVAL;
+    }
+
+    uint64_t url_hash = hash_string(url);
+    const archive_index_entry_t* entries = (const archive_index_entry_t*)(reader->index + 1);
+
+    // Lower bound, so that first record of the URL is found
+    size_t lo = 0;
+    size_t hi = reader->index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].url_hash < url_hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Different URLs can share a hash, equal hashes are kept in archive order
+    for (size_t i = lo; i < reader->index->count && entries[i].url_hash == url_hash; ++i) {
+        if (record_matches(reader, &entries[i], url)) {
+            *out_offset = entries[i].offset;
+            *out_length = entries[i].length;
+            return 0;
+        }
+    }
+
+    return ENOENT;
+}
+
+int archive_reader_copy(const archive_reader_t* reader, uint64_t offset, uint64_t length, FILE* out)
+{
+    if (!reader || !out) {
+        return EINVAL;
+    }
+
+    fflush(out);
+
+    off_t pos = offset;
+    while (length > 0) {
+        ssize_t res = sendfile(fileno(out), reader->fd, &pos, (length > SSIZE_MAX ? SSIZE_MAX : length));
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        else if (res == 0) {
+            fprintf(stderr, "Archive is truncated\n");
+            return EIO;
+        }
+
+        length -= res;
+    }
+
+    // Output sendfile can not handle, copy through a buffer
+    char buf[65536];
+    while (length > 0) {
+        ssize_t res = pread(reader->fd, buf, (length > sizeof(buf) ? sizeof(buf) : length), pos);
+        if (res <= 0) {
+            int error = (res < 0 ? errno : EIO);
+            fprintf(stderr, "Failed to read archive: %s\n", strerror(error));
+            return error;
+        }
+
+        if (fwrite(buf, 1, res, out) != (size_t)res) {
+            return errno;
+        }
+
+        pos += res;
+        length -= res;
+    }
+
+    return 0;
+}
+
+/*************************************************************************************/
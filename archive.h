@@ -0,0 +1,108 @@
+/**
+ * @file archive.h
+ *
+ * WARC style container for many replies with a sorted lookup index
+ */
+
+#ifndef _HTTPGET_ARCHIVE_H_
+#define _HTTPGET_ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Archive writer opaque context
+ */
+typedef struct archive archive_t;
+
+/**
+ * @brief   Archive reader opaque context
+ */
+typedef struct archive_reader archive_reader_t;
+
+/**
+ * @brief   Index file entry, index is an array of these sorted by url_hash following archive_index_header_t
+ */
+typedef struct archive_index_entry
+{
+    uint64_t url_hash;              // 64 bit FNV-1a of record URL
+    uint64_t offset;                // Reply body offset in archive file
+    uint64_t length;                // Reply body length
+    uint64_t url_offset;            // Target URI of the record in archive file, tells apart URLs of equal hash
+} archive_index_entry_t;
+
+typedef struct archive_index_header
+{
+    char magic[8];                  // ARCHIVE_INDEX_MAGIC
+    uint64_t count;                 // Number of entries
+} archive_index_header_t;
+
+#define ARCHIVE_INDEX_MAGIC     "HGETIDX2"
+#define ARCHIVE_INDEX_SUFFIX    ".idx"
+
+/**
+ * @brief       Create new archive file at @path@, index goes next to it with ARCHIVE_INDEX_SUFFIX.
+ *
+ * @out_archive On success will contain pointer to archive writer.
+ *              Caller is responsible to finish it using @archive_close@
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int archive_open(const char* path, archive_t** out_archive);
+
+/**
+ * @brief       Append reply record. Records are buffered and written out in large sequential chunks.
+ *
+ * @url         Request URL
+ * @header      Raw reply header including status line and terminating empty line
+ * @body        Reply body
+ *
+ * @returns     0 on success, errno value if write failed.
+ */
+int archive_append(archive_t* archive, const char* url,
+                   const char* header, size_t header_length,
+                   const char* body, size_t body_length);
+
+/**
+ * @brief       Flush remaining records, write sorted index and free archive writer.
+ *
+ * @returns     0 on success, errno value if archive or index could not be written.
+ */
+int archive_close(archive_t* archive);
+
+/**
+ * @brief       Open archive at @path@ and map its index for lookups.
+ *
+ * @returns     0 on success, errno value on failure, EINVAL if index is malformed.
+ */
+int archive_reader_open(const char* path, archive_reader_t** out_reader);
+
+/**
+ * @brief       Free archive reader.
+ */
+void archive_reader_close(archive_reader_t* reader);
+
+/**
+ * @brief       Binary search index for body of URL. If URL was stored more than once, first record is returned.
+ *              Hash matches are confirmed against record target URI, so URLs of equal hash are told apart.
+ *
+ * @returns     0 on success, ENOENT if archive has no such URL.
+ */
+int archive_reader_find(const archive_reader_t* reader, const char* url, uint64_t* out_offset, uint64_t* out_length);
+
+/**
+ * @brief       Copy stored body to output file without passing it through userspace.
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int archive_reader_copy(const archive_reader_t* reader, uint64_t offset, uint64_t length, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
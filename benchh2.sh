@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Compare connection per URL HTTP/1.0 against h2c streams on one connection, in requests per second.
+# nghttpx in front of test/testsrv.py takes both protocols on the same port, so only the client side differs.
+# Usage: ./benchh2.sh [requests] [concurrency] [nghttpx binary]
+
+COUNT=${1:-2000}
+JOBS=${2:-64}
+NGHTTPX=${3:-nghttpx}
+PORT=18082
+BACKEND_PORT=18083
+DIR=$(mktemp -d)
+
+cleanup() {
+    [ -n "$PROXY" ] && kill $PROXY
+    [ -n "$BACKEND" ] && kill $BACKEND
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+python3 test/testsrv.py --port $BACKEND_PORT --quiet &
+BACKEND=$!
+
+$NGHTTPX --frontend="127.0.0.1,$PORT;no-tls" --backend="127.0.0.1,$BACKEND_PORT" \
+    --workers=4 --log-level=ERROR --errorlog-file=/dev/null > /dev/null 2>&1 &
+PROXY=$!
+sleep 1
+
+for i in $(seq $COUNT); do echo "http://127.0.0.1:$PORT/size/512?$i"; done > $DIR/urls
+
+run() {
+    local start=$(date +%s.%N)
+    ./httpget -i $DIR/urls -a $DIR/archive -j $JOBS -H maxconn=$JOBS -P "$1" 2>&1 > /dev/null | grep "^Fetched"
+    awk -v s=$start -v e=$(date +%s.%N) -v n=$COUNT -v p="$1" 'BEGIN { printf "%s: %.0f requests per second\n", p, n / (e - s) }'
+}
+
+run http1
+run h2c
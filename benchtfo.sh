@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# Compare regular handshake against TCP fast open on loopback with injected latency.
+# Needs root for netem and tcp_fastopen sysctl. Usage: ./benchtfo.sh [delay ms] [requests]
+
+DELAY=${1:-20}
+COUNT=${2:-50}
+PORT=18080
+DIR=$(mktemp -d)
+TFO_SYSCTL=$(sysctl -n net.ipv4.tcp_fastopen)
+
+cleanup() {
+    tc qdisc del dev lo root 2>/dev/null
+    sysctl -q -w net.ipv4.tcp_fastopen=$TFO_SYSCTL
+    [ -n "$SERVER" ] && kill $SERVER
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+# Enable fast open for both client and server side
+sysctl -q -w net.ipv4.tcp_fastopen=3 || exit 1
+
+head -c 4096 /dev/urandom > $DIR/payload
+
+# http.server does not enable TCP_FASTOPEN on listening socket on its own
+python3 - $PORT $DIR <<'EOF' &
+import sys, socket, functools, http.server
+class TFOServer(http.server.HTTPServer):
+    def server_bind(self):
+        self.socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_FASTOPEN, 256)
+        super().server_bind()
+handler = functools.partial(http.server.SimpleHTTPRequestHandler, directory=sys.argv[2])
+handler.func.log_message = lambda *args: None
+TFOServer(('127.0.0.1', int(sys.argv[1])), handler).serve_forever()
+EOF
+SERVER=$!
+sleep 1
+
+tc qdisc add dev lo root netem delay ${DELAY}ms || echo "netem is not available, running without injected latency"
+
+for i in $(seq $COUNT); do echo "http://127.0.0.1:$PORT/payload"; done > $DIR/urls
+
+run() {
+    local start=$(date +%s.%N)
+    ./httpget -i $DIR/urls -o $DIR -t "$1" > /dev/null 2>&1 || echo "httpget failed"
+    awk -v s=$start -v e=$(date +%s.%N) -v n=$COUNT -v p="$1" 'BEGIN { printf "%s: %.2f ms per request\n", p, (e - s) * 1000 / n }'
+}
+
+run nodelay
+run nodelay,fastopen
+nstat -az TcpExtTCPFastOpenActive TcpExtTCPFastOpenPassive 2>/dev/null
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Compare full TLS handshakes against resumed ones using local openssl s_server.
+# Usage: ./benchtls.sh [requests] [openssl binary]
+
+COUNT=${1:-50}
+OPENSSL=${2:-openssl}
+PORT=18443
+DIR=$(mktemp -d)
+
+cleanup() {
+    [ -n "$SERVER" ] && kill $SERVER
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+$OPENSSL req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout $DIR/key.pem -out $DIR/cert.pem > /dev/null 2>&1 || exit 1
+
+head -c 4096 /dev/urandom > $DIR/payload
+
+# -WWW serves files from current directory over HTTP/1.0, one connection at a time
+(cd $DIR && exec $OPENSSL s_server -accept $PORT -cert cert.pem -key key.pem -WWW -quiet > /dev/null 2>&1) &
+SERVER=$!
+sleep 1
+
+for i in $(seq $COUNT); do echo "https://localhost:$PORT/payload"; done > $DIR/urls
+
+run() {
+    local start=$(date +%s.%N)
+    ./httpget -i $DIR/urls -o $DIR -s "cafile=$DIR/cert.pem$1" 2>&1 > /dev/null | grep "^TLS\|^kTLS\|^Fetched"
+    awk -v s=$start -v e=$(date +%s.%N) -v n=$COUNT -v p="${1:-,resume}" 'BEGIN { printf "%s: %.2f ms per request\n", substr(p, 2), (e - s) * 1000 / n }'
+}
+
+run ",noresume"
+run ""
+run ",ktls"
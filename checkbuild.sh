@@ -1,5 +1,6 @@
 #!/bin/bash
 
-make clean && make urltest && valgrind --leak-check=full ./urltest || { echo 'Unit tests failed' ; exit 1 ; }
+make clean && make urltest timertest archivetest statstest hostschedtest netopttest && valgrind --leak-check=full ./urltest && valgrind --leak-check=full ./timertest && valgrind --leak-check=full ./archivetest && valgrind --leak-check=full ./statstest && valgrind --leak-check=full ./hostschedtest && valgrind --leak-check=full ./netopttest || { echo 'Unit tests failed' ; exit 1 ; }
 scan-build -v -V make && valgrind --leak-check=full ./httpget -u http://www.w3.org/Protocols/rfc2616/rfc2616.html
-
+./test/tlsresume.sh || { echo 'TLS resumption test failed' ; exit 1 ; }
+./test/tlsstall.sh || { echo 'TLS handshake deadline test failed' ; exit 1 ; }
@@ -0,0 +1,2149 @@
+#define _POSIX_SOURCE
+#define _GNU_SOURCE
+
+#include "fetch.h"
+#include "url.h"
+#include "timer.h"
+#include "hostsched.h"
+#include "archive.h"
+#include "tls.h"
+#include "h2.h"
+#include "stats.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <pcre.h>
+
+/*************************************************************************************************/
+
+#if !defined(countof)
+#   define countof(_arr_)   (sizeof((_arr_)) / sizeof(*(_arr_)))
+#endif
+
+#if !defined(container_of)
+#   define container_of(_ptr_, _type_, _member_) ((_type_*)((char*)(_ptr_) - offsetof(_type_, _member_)))
+#endif
+
+#define HTTP_HEADER_MAX             16384
+#define RECV_BUFFER_SIZE            65536
+#define MAX_EPOLL_EVENTS            256
+#define REDIRECT_INITIAL_BUCKETS    64
+
+typedef enum transfer_state
+{
+    TRANSFER_QUEUED,
+    TRANSFER_CONNECTING,
+    TRANSFER_HANDSHAKE,
+    TRANSFER_SENDING,
+    TRANSFER_RECV_HEADER,
+    TRANSFER_RECV_BODY,
+} transfer_state_t;
+
+/*
+ * Something registered with epoll: transfer socket or shared HTTP/2 connection
+ */
+typedef struct poll_entry
+{
+    void (*on_event)(struct poll_entry* entry, uint32_t events);
+    uint32_t events;                // Current epoll interest
+} poll_entry_t;
+
+/*
+ * HTTP/2 connection carrying streams of many transfers to the same host
+ */
+typedef struct h2_conn
+{
+    poll_entry_t poll;
+    fetcher_t* fetcher;
+    struct h2_conn* next;           // All connections list
+
+    char* hostkey;
+    int sockfd;
+    bool connected;
+    bool in_recv;                   // Inside session receive, queued frames are sent once it returns
+    h2_session_t* session;
+    size_t nstreams;                // Transfers attached to this connection
+} h2_conn_t;
+
+/*
+ * Permanent redirect seen in this run
+ */
+typedef struct redirect_entry
+{
+    struct redirect_entry* next;
+    char* from;
+    char* to;
+} redirect_entry_t;
+
+/*
+ * Single URL download
+ */
+typedef struct transfer
+{
+    timer_entry_t timer;            // Nearest deadline or retry time of this transfer, has to be the first member
+    sched_item_t item;              // Host queue entry
+    fetcher_t* fetcher;
+    struct transfer* prev;          // All transfers list links
+    struct transfer* next;
+
+    char* urlstr;                   // URL as it was requested, transfer is reported and archived under it
+    char* outpath;
+    char* redirect_url;             // Current target once redirected, NULL before that
+    url_t url;                      // Current target
+    unsigned redirects;             // Redirect hops followed so far
+    const char* port;               // URL port or scheme default
+    bool https;
+    FILE* outfile;
+
+    transfer_state_t state;
+    int sockfd;
+    poll_entry_t poll;
+    tls_conn_t* tls;
+    uint64_t handshake_time;        // TLS handshake microseconds
+    bool resumed;                   // TLS session was resumed
+    h2_conn_t* h2conn;              // Shared connection in h2c mode, sockfd is not used then
+    int32_t stream_id;
+
+    char* request;
+    size_t request_length;
+    size_t request_sent;
+
+    char* header;                   // Reply header, NUL terminated, only allocated until header is complete unless archiving
+    size_t header_length;
+    size_t header_size;             // Size of complete header including terminating empty line
+    char* body;                     // Reply body kept in memory until it goes to archive
+    size_t body_length;
+    size_t body_capacity;
+    long status_code;
+    uint64_t retry_after;           // Milliseconds from 503 reply Retry-After header
+    size_t content_length;          // Reply body size, SIZE_MAX if server did not tell
+    bool keep_alive;                // Server keeps connection open after reply
+    char* location;                 // Resolved target of redirect reply, its body is skipped
+
+    uint64_t start_time;            // All times are CLOCK_MONOTONIC milliseconds
+    uint64_t request_time;          // Current request started going to its host, host latency counts from it
+    uint64_t connect_time;
+    uint64_t first_byte_time;
+    uint64_t last_read_time;
+    uint64_t rate_window_start;
+    size_t rate_window_bytes;
+    size_t total_bytes;
+} transfer_t;
+
+struct fetcher
+{
+    fetch_options_t opts;
+
+    url_parser_t* url_parser;
+    pcre* status_re;
+    tls_context_t* tls;
+
+    int epfd;
+    timer_wheel_t timers;
+    char* recvbuf;
+
+    sched_t* sched;
+    transfer_t* transfers;          // Every transfer that is not complete yet
+    h2_conn_t* h2conns;
+    redirect_entry_t** redirects;   // Permanent redirect cache, chained buckets grown with entries
+    size_t nredirect_buckets;
+    size_t nredirects;
+    size_t ninflight;
+    size_t nwaiting;                // Transfers waiting for retry backoff to expire
+
+    size_t ntransfers;
+    size_t nfailed;
+    int first_error;
+
+    stats_t stats;
+    timer_entry_t stats_timer;
+};
+
+/*************************************************************************************************/
+
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void fetch_options_init(fetch_options_t* opts, net_options_t* netopts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->netopts = netopts;
+    opts->max_inflight = 1;
+    opts->min_rate_period = 10000;
+    opts->max_redirects = 5;
+
+    sched_options_init(&opts->sched);
+    tls_options_init(&opts->tls);
+    h2_options_init(&opts->h2);
+    stats_options_init(&opts->stats);
+}
+
+void fetch_options_free(fetch_options_t* opts)
+{
+    if (opts) {
+        tls_options_free(&opts->tls);
+        stats_options_free(&opts->stats);
+    }
+}
+
+int fetch_options_parse_timeouts(fetch_options_t* opts, const char* spec)
+{
+    int error = 0;
+
+    if (!opts || !spec) {
+        return EINVAL;
+    }
+
+    char* list = strdup(spec);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        char* end = NULL;
+        long value = (valstr ? strtol(valstr, &end, 10) : -1);
+        if (!valstr || *end != '\0' || value < 0 || value > INT_MAX) {
+            fprintf(stderr, "Invalid value for timeout option '%s'\n", name);
+            error = EINVAL;
+            break;
+        }
+
+        if (0 == strcmp(name, "connect")) {
+            opts->connect_timeout = value;
+        } else if (0 == strcmp(name, "firstbyte")) {
+            opts->first_byte_timeout = value;
+        } else if (0 == strcmp(name, "idle")) {
+            opts->idle_timeout = value;
+        } else if (0 == strcmp(name, "total")) {
+            opts->total_timeout = value;
+        } else if (0 == strcmp(name, "minrate")) {
+            opts->min_rate = value;
+        } else if (0 == strcmp(name, "rateperiod") && value > 0) {
+            opts->min_rate_period = value;
+        } else {
+            fprintf(stderr, "Unknown timeout option '%s'\n", name);
+            error = EINVAL;
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+/*************************************************************************************************/
+
+/*
+ * Nearest deadline of a transfer in its current state and the phase it belongs to
+ */
+static uint64_t transfer_next_deadline(const transfer_t* t, const char** out_phase)
+{
+    const fetch_options_t* opts = &t->fetcher->opts;
+    uint64_t deadline = UINT64_MAX;
+
+    #define consider_deadline(_timeout_, _from_, _phase_)   \
+        if ((_timeout_) && ((_from_) + (_timeout_) < deadline)) {  \
+            deadline = (_from_) + (_timeout_);              \
+            *out_phase = (_phase_);                         \
+        }                                                   \
+
+    consider_deadline(opts->total_timeout, t->start_time, "total");
+
+    if (t->state == TRANSFER_CONNECTING || t->state == TRANSFER_HANDSHAKE) {
+        consider_deadline(opts->connect_timeout, t->request_time, "connect");
+    } else if (!t->first_byte_time) {
+        consider_deadline(opts->first_byte_timeout, t->connect_time, "first byte");
+    } else {
+        consider_deadline(opts->idle_timeout, t->last_read_time, "idle");
+        consider_deadline((opts->min_rate ? opts->min_rate_period : 0), t->rate_window_start, "transfer rate");
+    }
+
+    #undef consider_deadline
+
+    return deadline;
+}
+
+/*
+ * Arm transfer timer for its nearest deadline.
+ * Reads do not touch the timer, idle deadline is pushed back lazily when the timer fires.
+ */
+static void transfer_update_timer(transfer_t* t)
+{
+    const char* phase = NULL;
+    uint64_t deadline = transfer_next_deadline(t, &phase);
+    if (deadline == UINT64_MAX) {
+        timer_cancel(&t->fetcher->timers, &t->timer);
+    } else {
+        timer_schedule(&t->fetcher->timers, &t->timer, deadline);
+    }
+}
+
+static void transfer_free(transfer_t* t)
+{
+    if (t)
+    {
+        if (t->prev) {
+            t->prev->next = t->next;
+        } else {
+            t->fetcher->transfers = t->next;
+        }
+
+        if (t->next) {
+            t->next->prev = t->prev;
+        }
+
+        url_free(&t->url);
+        free(t->urlstr);
+        free(t->outpath);
+        free(t->redirect_url);
+        free(t->location);
+        free(t->request);
+        free(t->header);
+        free(t->body);
+        free(t);
+    }
+}
+
+/*
+ * Account for final transfer result and release it
+ */
+static void transfer_complete(transfer_t* t, int error)
+{
+    fetcher_t* fetcher = t->fetcher;
+    uint64_t now = now_ms();
+
+    ++fetcher->stats.requests;
+
+    if (error) {
+        ++fetcher->nfailed;
+        if (!fetcher->first_error) {
+            fetcher->first_error = error;
+        }
+
+        ++fetcher->stats.failures;
+        ++fetcher->stats.errors[stats_classify(error, t->status_code)];
+    } else {
+        hdr_record(&fetcher->stats.ttfb, t->first_byte_time - t->start_time);
+        hdr_record(&fetcher->stats.duration, now - t->start_time);
+
+        char tls_time[64] = "";
+        if (t->https) {
+            snprintf(tls_time, sizeof(tls_time), ", %s TLS handshake %.2f ms",
+                     (t->resumed ? "resumed" : "full"), t->handshake_time / 1000.0);
+        }
+
+        fprintf(stderr, "%s: fetched %zu bytes in %lu ms (connect %lu ms%s, first byte %lu ms)\n",
+                t->urlstr, t->total_bytes, (unsigned long)(now - t->start_time),
+                (unsigned long)(t->connect_time - t->start_time), tls_time,
+                (unsigned long)(t->first_byte_time - t->start_time));
+    }
+
+    transfer_free(t);
+}
+
+/*
+ * Errors that mean the connection was never established. With TCP_FASTOPEN_CONNECT the connect happens
+ * inside the first send, so these show up in the sending state instead of the connecting state.
+ */
+static bool is_connect_error(const transfer_t* t, int error)
+{
+    return (t->state == TRANSFER_CONNECTING) ||
+           (error == ECONNREFUSED) || (error == EHOSTUNREACH) || (error == ENETUNREACH) ||
+           (error == ETIMEDOUT && t->state <= TRANSFER_SENDING);
+}
+
+/*
+ * Failures that say something about host health
+ */
+static bool is_host_failure(const transfer_t* t, int error)
+{
+    return (t->status_code >= 500) || is_connect_error(t, error) ||
+           (error == ETIMEDOUT) || (error == ECONNRESET);
+}
+
+/*
+ * Only connect failures, refused HTTP/2 streams, connections reset before reply was complete and 5xx replies
+ * are retried, GET is idempotent so this is always safe
+ */
+static bool is_retriable(const transfer_t* t, int error)
+{
+    return (t->status_code >= 500) || is_connect_error(t, error) || (error == ECONNRESET);
+}
+
+/*
+ * Retry backoff expired, put transfer back into its host queue
+ */
+static void on_retry_timer(timer_entry_t* timer, void* ctx)
+{
+    transfer_t* t = (transfer_t*)timer;
+
+    --t->fetcher->nwaiting;
+    sched_requeue(t->fetcher->sched, &t->item);
+}
+
+/*
+ * Forget everything about the previous attempt
+ */
+static void transfer_reset(transfer_t* t)
+{
+    free(t->header);
+    t->header = NULL;
+    t->header_length = t->header_size = 0;
+
+    free(t->body);
+    t->body = NULL;
+    t->body_length = t->body_capacity = 0;
+
+    t->state = TRANSFER_QUEUED;
+    t->sockfd = -1;
+    t->poll.events = 0;
+    t->tls = NULL;
+    t->handshake_time = 0;
+    t->resumed = false;
+    t->outfile = NULL;
+    t->request_sent = 0;
+    t->status_code = 0;
+    t->retry_after = 0;
+    t->content_length = SIZE_MAX;
+    t->keep_alive = false;
+    free(t->location);
+    t->location = NULL;
+    t->start_time = t->request_time = 0;
+    t->connect_time = t->first_byte_time = t->last_read_time = 0;
+    t->rate_window_start = 0;
+    t->rate_window_bytes = t->total_bytes = 0;
+}
+
+/*
+ * Finish inflight transfer attempt with given result, then either schedule a retry or complete it
+ */
+static void h2_transfer_detach(transfer_t* t);
+static int transfer_redirect(transfer_t* t);
+
+static void transfer_finish(transfer_t* t, int error)
+{
+    fetcher_t* fetcher = t->fetcher;
+    const sched_options_t* schedopts = &fetcher->opts.sched;
+
+    timer_cancel(&fetcher->timers, &t->timer);
+
+    // Redirect reply is complete, transfer goes on to its target
+    if (!error && t->location) {
+        error = transfer_redirect(t);
+        if (!error) {
+            return;
+        }
+    }
+
+    uint64_t now = now_ms();
+
+    // Reply that ended without error is complete, even if server has not closed connection yet
+    h2_transfer_detach(t);
+    tls_close(t->tls, !error);
+    if (t->sockfd >= 0) {
+        close(t->sockfd);
+    }
+
+    if (t->outfile && t->outfile != stdout) {
+        fclose(t->outfile);
+    }
+
+    --fetcher->ninflight;
+
+    // Complete replies only, a failed attempt may still be retried
+    if (!error && fetcher->opts.archive) {
+        error = archive_append(fetcher->opts.archive, t->urlstr, t->header, t->header_size, t->body, t->body_length);
+    }
+
+    sched_result_t result = SCHED_ABORTED;
+    if (error && is_host_failure(t, error)) {
+        result = SCHED_FAILURE;
+    } else if (t->first_byte_time) {
+        result = SCHED_SUCCESS;
+    }
+
+    sched_done(fetcher->sched, &t->item, result, t->first_byte_time - t->request_time, now);
+
+    if (!error || !is_retriable(t, error) || (t->item.attempts > schedopts->max_retries)) {
+        transfer_complete(t, error);
+        return;
+    }
+
+    uint64_t delay = sched_backoff(fetcher->sched, &t->item);
+    if (t->retry_after) {
+        delay = (t->retry_after < schedopts->backoff_max ? t->retry_after : schedopts->backoff_max);
+    }
+
+    fprintf(stderr, "%s: retrying in %lu ms (attempt %u of %u)\n",
+            t->urlstr, (unsigned long)delay, t->item.attempts + 1, schedopts->max_retries + 1);
+
+    ++fetcher->stats.retries;
+
+    transfer_reset(t);
+    timer_init(&t->timer, on_retry_timer);
+    timer_schedule(&fetcher->timers, &t->timer, now + delay);
+    ++fetcher->nwaiting;
+}
+
+/*
+ * Deadline timer callback
+ */
+static void on_transfer_timer(timer_entry_t* timer, void* ctx)
+{
+    transfer_t* t = (transfer_t*)timer;
+    const fetch_options_t* opts = &t->fetcher->opts;
+    uint64_t now = now_ms();
+
+    while (1)
+    {
+        const char* phase = NULL;
+        uint64_t deadline = transfer_next_deadline(t, &phase);
+        if (deadline > now) {
+            if (deadline != UINT64_MAX) {
+                timer_schedule(&t->fetcher->timers, &t->timer, deadline);
+            }
+            return;
+        }
+
+        // Rate window is over, start a new one if we have received enough in this one
+        if ((0 == strcmp(phase, "transfer rate")) &&
+            (t->rate_window_bytes * 1000 >= opts->min_rate * opts->min_rate_period)) {
+            t->rate_window_start = now;
+            t->rate_window_bytes = 0;
+            continue;
+        }
+
+        fprintf(stderr, "%s: timed out in %s phase after %lu ms\n",
+                t->urlstr, phase, (unsigned long)(now - t->start_time));
+        transfer_finish(t, ETIMEDOUT);
+        return;
+    }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Prepare HTTP get request accroding to URL contents
+ */
+static int build_http_get(transfer_t* t)
+{
+    const url_t* url = &t->url;
+
+    // Build HTTP get query, connection is only worth keeping when it may carry a redirected request
+    const char* format = (t->fetcher->opts.max_redirects ?
+        "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n" :
+        "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n");
+    const char* path = (url->target ? url->target : "/");
+
+    size_t query_length = snprintf(NULL, 0, format, path, url->host);
+    size_t bufsize = query_length + 1;
+
+    char* query = calloc(1, bufsize);
+    if (!query) {
+        fprintf(stderr, "No memory to allocate query buffer size %zd\n", bufsize);
+        return ENOMEM;
+    }
+
+    snprintf(query, bufsize, format, path, url->host);
+
+    t->request = query;
+    t->request_length = query_length;
+    t->request_sent = 0;
+    return 0;
+}
+
+/*
+ * Create a non-blocking socket for given address and start connecting it using source address pool
+ */
+static int connect_addr(fetcher_t* fetcher, const struct addrinfo* hostinfo, int* out_fd, bool* out_connected)
+{
+    int error = 0;
+
+    int fd = socket(hostinfo->ai_family, hostinfo->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, hostinfo->ai_protocol);
+    if (fd < 0) {
+        error = errno;
+        perror("Failed to create socket");
+        return error;
+    }
+
+    error = net_options_apply(fetcher->opts.netopts, fd, hostinfo->ai_family);
+    if (error) {
+        goto error_out;
+    }
+
+    // Connect returns right away with TCP fast open, handshake happens with the first send
+    *out_connected = true;
+    if (connect(fd, hostinfo->ai_addr, hostinfo->ai_addrlen)) {
+        if (errno != EINPROGRESS) {
+            error = errno;
+            fprintf(stderr, "Failed to connect: %s\n", strerror(error));
+            goto error_out;
+        }
+
+        *out_connected = false;
+    }
+
+    *out_fd = fd;
+    return 0;
+
+error_out:
+    close(fd);
+    return error;
+}
+
+/*
+ * Start connecting to transfer host.
+ * Name resolution is still synchronous, only connect itself goes through the event loop.
+ */
+static int connect_socket(fetcher_t* fetcher, const char* host, const char* port, int* out_fd, bool* out_connected)
+{
+    int error = 0;
+    net_options_t* netopts = fetcher->opts.netopts;
+
+    struct addrinfo hints;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = 0;
+    hints.ai_flags = 0;
+
+    struct addrinfo* res = NULL;
+    error = getaddrinfo(host, port, &hints, &res);
+    if (error) {
+        fprintf(stderr, "getaddrinfo('%s') failed with %s\n", host, gai_strerror(error));
+        return error;
+    }
+
+    struct addrinfo* hostinfo = res;
+    while (hostinfo != NULL)
+    {
+        // Look for AF_INET and AF_INET6 family
+        if (hostinfo->ai_family == AF_INET || hostinfo->ai_family == AF_INET6) {
+            break;
+        }
+
+        hostinfo = hostinfo->ai_next;
+    }
+
+    if (!hostinfo) {
+        fprintf(stderr, "Could not find suitable addrinfo to connect\n");
+        error = ENOENT;
+        goto error_out;
+    }
+
+    // Out of ephemeral ports on one source address does not mean the rest of the pool is exhausted too
+    size_t attempts = (netopts->nsrcaddrs ? netopts->nsrcaddrs : 1);
+    while (attempts-- > 0)
+    {
+        error = connect_addr(fetcher, hostinfo, out_fd, out_connected);
+        if (!net_options_count_failure(netopts, error)) {
+            break;
+        }
+    }
+
+error_out:
+    freeaddrinfo(res);
+    return error;
+}
+
+/*
+ * Find header field value in NUL terminated reply header, NULL if there is no such field
+ */
+static const char* find_header(const char* header, const char* name)
+{
+    size_t namelen = strlen(name);
+
+    for (const char* line = strstr(header, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (0 == strncasecmp(line, name, namelen) && line[namelen] == ':') {
+            const char* value = line + namelen + 1;
+            while (*value == ' ' || *value == '\t') {
+                ++value;
+            }
+            return value;
+        }
+    }
+
+    return NULL;
+}
+
+static int check_http_reply(transfer_t* t);
+
+static bool is_redirect(long status_code)
+{
+    return (status_code == 301) || (status_code == 302) || (status_code == 303) ||
+           (status_code == 307) || (status_code == 308);
+}
+
+/*
+ * Resolve redirect target against current URL, transfer goes there once redirect reply is complete
+ */
+static int check_redirect(transfer_t* t)
+{
+    const fetch_options_t* opts = &t->fetcher->opts;
+
+    const char* location = find_header(t->header, "Location");
+    if (!location || opts->max_redirects == 0) {
+        fprintf(stderr, "%s: HTTP request failed\n", t->urlstr);
+        return EPROTO;
+    }
+
+    if (t->redirects >= opts->max_redirects) {
+        fprintf(stderr, "%s: Too many redirects, gave up after %u\n", t->urlstr, t->redirects);
+        return ELOOP;
+    }
+
+    size_t length = strcspn(location, "\r\n");
+    while (length > 0 && (location[length - 1] == ' ' || location[length - 1] == '\t')) {
+        --length;
+    }
+
+    char* reference = strndup(location, length);
+    if (!reference) {
+        return ENOMEM;
+    }
+
+    int error = url_resolve(&t->url, reference, &t->location);
+    free(reference);
+    return error;
+}
+
+/*
+ * Parse complete HTTP reply header, extract and check status
+ */
+static int parse_http_reply(transfer_t* t)
+{
+    int res = 0;
+
+    int matchvec[9] = {0};
+    int nmatches = pcre_exec(t->fetcher->status_re, NULL, t->header, t->header_length, 0, 0, matchvec, countof(matchvec));
+    if (nmatches < 0) {
+        fprintf(stderr, "%s: HTTP reply header match failed: %d\n", t->urlstr, nmatches);
+        return -1;
+    }
+
+    const char* status_code_str = NULL;
+    res = pcre_get_substring(t->header, matchvec, nmatches, 1, &status_code_str);
+    if (res < 0) {
+        fprintf(stderr, "%s: Status code string failed to match\n", t->urlstr);
+        return res;
+    }
+
+    // Check OK status
+    t->status_code = atol(status_code_str);
+    pcre_free_substring(status_code_str);
+
+    return check_http_reply(t);
+}
+
+/*
+ * Check reply status and pick up header fields we care about
+ */
+static int check_http_reply(transfer_t* t)
+{
+    fprintf(stderr, "%s: HTTP reply status code %ld\n", t->urlstr, t->status_code);
+
+    // Only delay-seconds form is understood, HTTP-date falls back to regular backoff
+    const char* retry_after = find_header(t->header, "Retry-After");
+    if (t->status_code == 503 && retry_after) {
+        t->retry_after = strtoul(retry_after, NULL, 10) * 1000;
+    }
+
+    // HTTP/1.0 connection persists only if server says so, HTTP/1.1 one unless server says otherwise
+    const char* connection = find_header(t->header, "Connection");
+    if (connection) {
+        t->keep_alive = (0 == strncasecmp(connection, "keep-alive", strlen("keep-alive")));
+    } else {
+        t->keep_alive = (0 == strncmp(t->header, "HTTP/1.1", strlen("HTTP/1.1")));
+    }
+
+    const char* content_length = find_header(t->header, "Content-Length");
+    t->content_length = (content_length ? strtoull(content_length, NULL, 10) : SIZE_MAX);
+
+    if (is_redirect(t->status_code)) {
+        return check_redirect(t);
+    }
+
+    if (t->status_code != 200) {
+        fprintf(stderr, "%s: HTTP request failed\n", t->urlstr);
+        return EPROTO;
+    }
+
+    return 0;
+}
+
+/*
+ * Store reply body bytes
+ */
+static int write_body(transfer_t* t, const char* data, size_t size)
+{
+    // Redirect reply body is of no interest
+    if (t->location) {
+        return 0;
+    }
+
+    if (t->fetcher->opts.archive) {
+        if (t->body_length + size > t->body_capacity) {
+            size_t capacity = (t->body_capacity ? t->body_capacity : RECV_BUFFER_SIZE);
+            while (capacity < t->body_length + size) {
+                capacity *= 2;
+            }
+
+            char* body = realloc(t->body, capacity);
+            if (!body) {
+                fprintf(stderr, "%s: No memory to keep reply body of %zu bytes\n", t->urlstr, capacity);
+                return ENOMEM;
+            }
+
+            t->body = body;
+            t->body_capacity = capacity;
+        }
+
+        memcpy(t->body + t->body_length, data, size);
+        t->body_length += size;
+        return 0;
+    }
+
+    if (size && (fwrite(data, 1, size, t->outfile) != size)) {
+        int error = errno;
+        fprintf(stderr, "%s: Failed to write output: %s\n", t->urlstr, strerror(error));
+        return error;
+    }
+
+    return 0;
+}
+
+/*
+ * Accumulate reply header, once it is complete parse it and pass what follows to body
+ */
+static int recv_header(transfer_t* t, const char* data, size_t size)
+{
+    size_t copy = size;
+    if (copy > HTTP_HEADER_MAX - t->header_length) {
+        copy = HTTP_HEADER_MAX - t->header_length;
+    }
+
+    memcpy(t->header + t->header_length, data, copy);
+
+    // Terminator may straddle previous read, look a bit back
+    size_t scan_from = (t->header_length > 3 ? t->header_length - 3 : 0);
+    t->header_length += copy;
+    t->header[t->header_length] = '\0';
+
+    char* end = memmem(t->header + scan_from, t->header_length - scan_from, "\r\n\r\n", 4);
+    if (!end) {
+        if (t->header_length == HTTP_HEADER_MAX) {
+            fprintf(stderr, "%s: HTTP reply header is too long\n", t->urlstr);
+            return EMSGSIZE;
+        }
+
+        return 0;
+    }
+
+    size_t header_size = end + 4 - t->header;
+    size_t body_offset = header_size - (t->header_length - copy);
+
+    int error = parse_http_reply(t);
+    if (error) {
+        return error;
+    }
+
+    // Archive record needs the header as well
+    t->header_size = header_size;
+    if (!t->fetcher->opts.archive) {
+        free(t->header);
+        t->header = NULL;
+    }
+
+    t->state = TRANSFER_RECV_BODY;
+    t->rate_window_start = t->last_read_time;
+    t->rate_window_bytes = size - body_offset;
+    t->total_bytes = size - body_offset;
+    t->fetcher->stats.bytes += size - body_offset;
+
+    return write_body(t, data + body_offset, size - body_offset);
+}
+
+/*
+ * Switch epoll interest of transfer socket
+ */
+static int poll_watch(fetcher_t* fetcher, int fd, poll_entry_t* entry, uint32_t events, int op)
+{
+    if (op == EPOLL_CTL_MOD && events == entry->events) {
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = entry;
+
+    if (epoll_ctl(fetcher->epfd, op, fd, &ev)) {
+        int error = errno;
+        perror("epoll_ctl failed");
+        return error;
+    }
+
+    entry->events = events;
+    return 0;
+}
+
+static int transfer_watch(transfer_t* t, uint32_t events, int op)
+{
+    return poll_watch(t->fetcher, t->sockfd, &t->poll, events, op);
+}
+
+/*
+ * TLS may have to write while reading and the other way round, wait for what it asked for
+ */
+static int transfer_watch_tls(transfer_t* t)
+{
+    return transfer_watch(t, (tls_want_write(t->tls) ? EPOLLOUT : EPOLLIN), EPOLL_CTL_MOD);
+}
+
+static int on_writable(transfer_t* t);
+
+/*
+ * Drive TLS handshake, once it is done proceed with sending request
+ */
+static int on_handshake(transfer_t* t)
+{
+    int error = tls_handshake(t->tls);
+    if (error == EAGAIN) {
+        return transfer_watch_tls(t);
+    } else if (error) {
+        return error;
+    }
+
+    t->handshake_time = tls_handshake_time(t->tls);
+    t->resumed = tls_resumed(t->tls);
+    t->connect_time = now_ms();
+    t->state = TRANSFER_SENDING;
+    transfer_update_timer(t);
+
+    if (t->resumed) {
+        ++t->fetcher->stats.tls_resumed;
+    } else {
+        ++t->fetcher->stats.tls_full;
+    }
+
+    error = transfer_watch(t, EPOLLOUT, EPOLL_CTL_MOD);
+    if (error) {
+        return error;
+    }
+
+    return on_writable(t);
+}
+
+static int on_connected(transfer_t* t)
+{
+    fprintf(stderr, "Connected to %s\n", t->url.host);
+
+    // Handshake is part of connect phase, connect deadline keeps running until it is done
+    if (t->https) {
+        char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+        snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+
+        int error = tls_connect(t->fetcher->tls, t->sockfd, t->url.host, hostkey, &t->tls);
+        if (error) {
+            return error;
+        }
+
+        t->state = TRANSFER_HANDSHAKE;
+        return on_handshake(t);
+    }
+
+    t->connect_time = now_ms();
+    t->state = TRANSFER_SENDING;
+    transfer_update_timer(t);
+    return 0;
+}
+
+static int on_writable(transfer_t* t)
+{
+    while (t->request_sent < t->request_length)
+    {
+        const char* data = t->request + t->request_sent;
+        size_t size = t->request_length - t->request_sent;
+
+        ssize_t res = (t->tls ? tls_send(t->tls, data, size) : send(t->sockfd, data, size, MSG_NOSIGNAL));
+        if (res == -1) {
+            // Fast open connect without a cookie reports EINPROGRESS until handshake completes
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) {
+                return (t->tls ? transfer_watch_tls(t) : 0);
+            }
+
+            // TLS errors are reported by TLS layer itself
+            if (t->tls) {
+                return errno;
+            }
+
+            int error = errno;
+            fprintf(stderr, "%s: send failed: %s\n", t->urlstr, strerror(error));
+            return error;
+        }
+
+        t->request_sent += res;
+    }
+
+    t->header = malloc(HTTP_HEADER_MAX + 1);
+    if (!t->header) {
+        return ENOMEM;
+    }
+
+    t->state = TRANSFER_RECV_HEADER;
+    return transfer_watch(t, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+static int on_readable(transfer_t* t, bool* out_done)
+{
+    fetcher_t* fetcher = t->fetcher;
+
+    ssize_t nbytes = (t->tls ? tls_recv(t->tls, fetcher->recvbuf, RECV_BUFFER_SIZE)
+                             : recv(t->sockfd, fetcher->recvbuf, RECV_BUFFER_SIZE, 0));
+    if (nbytes == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return (t->tls ? transfer_watch_tls(t) : 0);
+        }
+
+        // TLS errors are reported by TLS layer itself
+        if (t->tls) {
+            return errno;
+        }
+
+        int error = errno;
+        fprintf(stderr, "%s: recv failed: %s\n", t->urlstr, strerror(error));
+        return error;
+    }
+    else if (nbytes == 0) {
+        if (t->state != TRANSFER_RECV_BODY) {
+            fprintf(stderr, "%s: Failed to recieve HTTP reply\n", t->urlstr);
+            return ECONNRESET;
+        }
+
+        // Close before announced length is a truncated reply, not the end of it
+        if (t->content_length != SIZE_MAX && t->total_bytes < t->content_length) {
+            fprintf(stderr, "%s: Connection closed after %zu of %zu body bytes\n",
+                    t->urlstr, t->total_bytes, t->content_length);
+            return ECONNRESET;
+        }
+
+        *out_done = true;
+        return 0;
+    }
+
+    net_options_rearm(fetcher->opts.netopts, t->sockfd);
+
+    // Back to waiting for input if TLS had to wait for output before
+    if (t->tls) {
+        int error = transfer_watch(t, EPOLLIN, EPOLL_CTL_MOD);
+        if (error) {
+            return error;
+        }
+    }
+
+    t->last_read_time = now_ms();
+    if (!t->first_byte_time) {
+        t->first_byte_time = t->last_read_time;
+        transfer_update_timer(t);
+    }
+
+    int error = 0;
+    if (t->state == TRANSFER_RECV_HEADER) {
+        error = recv_header(t, fetcher->recvbuf, nbytes);
+    } else {
+        t->rate_window_bytes += nbytes;
+        t->total_bytes += nbytes;
+        fetcher->stats.bytes += nbytes;
+        error = write_body(t, fetcher->recvbuf, nbytes);
+    }
+
+    // Reply of known length is complete without waiting for server to close connection
+    if (!error && t->state == TRANSFER_RECV_BODY && t->total_bytes >= t->content_length) {
+        *out_done = true;
+        return 0;
+    }
+
+    // Server may keep connection open after close_notify, do not wait for socket to become readable
+    if (!error && t->tls && tls_eof(t->tls)) {
+        return on_readable(t, out_done);
+    }
+
+    return error;
+}
+
+/*
+ * Drive transfer state machine on socket event
+ */
+static void on_transfer_event(poll_entry_t* entry, uint32_t events)
+{
+    transfer_t* t = container_of(entry, transfer_t, poll);
+    int error = 0;
+    bool done = false;
+
+    switch(t->state)
+    {
+    case TRANSFER_CONNECTING: {
+        socklen_t len = sizeof(error);
+        if (getsockopt(t->sockfd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+            error = errno;
+        }
+
+        if (error) {
+            net_options_count_failure(t->fetcher->opts.netopts, error);
+            fprintf(stderr, "%s: Failed to connect: %s\n", t->urlstr, strerror(error));
+            break;
+        }
+
+        error = on_connected(t);
+        if (error || t->state != TRANSFER_SENDING) {
+            break;
+        }
+
+        error = on_writable(t);
+        break;
+    }
+
+    case TRANSFER_HANDSHAKE:
+        error = on_handshake(t);
+        break;
+
+    case TRANSFER_SENDING:
+        error = on_writable(t);
+        break;
+
+    case TRANSFER_RECV_HEADER:
+    case TRANSFER_RECV_BODY:
+        error = on_readable(t, &done);
+        break;
+
+    case TRANSFER_QUEUED:
+        assert(0);
+        break;
+    }
+
+    if (error || done) {
+        transfer_finish(t, error);
+    }
+}
+
+/*************************************************************************************************/
+
+/*
+ * HTTP/2 reply header field, kept in HTTP/1 form so reply checks and archive records do not depend on protocol
+ */
+static void on_h2_header(void* stream_ctx, const char* name, size_t namelen, const char* value, size_t valuelen)
+{
+    transfer_t* t = stream_ctx;
+
+    // Trailers are of no interest
+    if (t->state != TRANSFER_RECV_HEADER) {
+        return;
+    }
+
+    if (!t->first_byte_time) {
+        t->first_byte_time = t->last_read_time = now_ms();
+        transfer_update_timer(t);
+    }
+
+    // Status comes first, informational reply is followed by the real one
+    if (namelen == 7 && 0 == memcmp(name, ":status", 7)) {
+        t->header_length = 0;
+    }
+
+    size_t room = HTTP_HEADER_MAX - t->header_length;
+    int len = (t->header_length == 0 ?
+        snprintf(t->header, room + 1, "HTTP/2 %.*s\r\n", (int)valuelen, value) :
+        snprintf(t->header + t->header_length, room + 1, "%.*s: %.*s\r\n", (int)namelen, name, (int)valuelen, value));
+
+    // Too long header is reported once it is complete
+    t->header_length = ((len < 0 || (size_t)len > room) ? HTTP_HEADER_MAX : t->header_length + len);
+}
+
+static void on_h2_headers_done(void* stream_ctx)
+{
+    transfer_t* t = stream_ctx;
+
+    if (t->state != TRANSFER_RECV_HEADER) {
+        return;
+    }
+
+    if (t->header_length + 2 > HTTP_HEADER_MAX) {
+        fprintf(stderr, "%s: HTTP reply header is too long\n", t->urlstr);
+        transfer_finish(t, EMSGSIZE);
+        return;
+    }
+
+    memcpy(t->header + t->header_length, "\r\n", 3);
+    t->header_length += 2;
+
+    t->status_code = strtol(t->header + strlen("HTTP/2 "), NULL, 10);
+    if (t->status_code < 200) {
+        t->header_length = 0;
+        return;
+    }
+
+    int error = check_http_reply(t);
+    if (error) {
+        transfer_finish(t, error);
+        return;
+    }
+
+    t->header_size = t->header_length;
+    if (!t->fetcher->opts.archive) {
+        free(t->header);
+        t->header = NULL;
+    }
+
+    t->state = TRANSFER_RECV_BODY;
+    t->rate_window_start = t->last_read_time;
+}
+
+/*
+ * DATA frames of a stream go to output of its transfer
+ */
+static void on_h2_data(void* stream_ctx, const char* data, size_t size)
+{
+    transfer_t* t = stream_ctx;
+
+    t->last_read_time = now_ms();
+    t->rate_window_bytes += size;
+    t->total_bytes += size;
+    t->fetcher->stats.bytes += size;
+
+    int error = write_body(t, data, size);
+    if (error) {
+        transfer_finish(t, error);
+    }
+}
+
+static void on_h2_stream_close(void* stream_ctx, int error)
+{
+    transfer_t* t = stream_ctx;
+
+    // Stream is gone already, there is nothing to cancel
+    t->stream_id = 0;
+
+    if (!error && t->state != TRANSFER_RECV_BODY) {
+        fprintf(stderr, "%s: Failed to recieve HTTP reply\n", t->urlstr);
+        error = ECONNRESET;
+    }
+
+    transfer_finish(t, error);
+}
+
+static const h2_callbacks_t g_h2_callbacks = {
+    .on_header = on_h2_header,
+    .on_headers_done = on_h2_headers_done,
+    .on_data = on_h2_data,
+    .on_stream_close = on_h2_stream_close,
+};
+
+static void h2_conn_free(h2_conn_t* conn)
+{
+    for (h2_conn_t** pconn = &conn->fetcher->h2conns; *pconn != NULL; pconn = &(*pconn)->next) {
+        if (*pconn == conn) {
+            *pconn = conn->next;
+            break;
+        }
+    }
+
+    h2_session_free(conn->session);
+    if (conn->sockfd >= 0) {
+        close(conn->sockfd);
+    }
+
+    free(conn->hostkey);
+    free(conn);
+}
+
+/*
+ * Send frames session has queued and wait for output room if they did not fit.
+ * Sending from inside session receive callbacks is not allowed, connection event handler sends them afterwards.
+ */
+static int h2_conn_flush(h2_conn_t* conn)
+{
+    if (!conn->connected || conn->in_recv) {
+        return 0;
+    }
+
+    int error = h2_session_send(conn->session);
+    if (error) {
+        return error;
+    }
+
+    uint32_t events = EPOLLIN | (h2_want_write(conn->session) ? EPOLLOUT : 0);
+    return poll_watch(conn->fetcher, conn->sockfd, &conn->poll, events, EPOLL_CTL_MOD);
+}
+
+/*
+ * Connection is unusable, fail every transfer on it and drop it
+ */
+static void h2_conn_fail(h2_conn_t* conn, int error)
+{
+    transfer_t* next = NULL;
+    for (transfer_t* t = conn->fetcher->transfers; t != NULL; t = next) {
+        next = t->next;
+        if (t->h2conn == conn) {
+            t->h2conn = NULL;
+            t->stream_id = 0;
+            transfer_finish(t, error);
+        }
+    }
+
+    h2_conn_free(conn);
+}
+
+static void on_h2_conn_connected(h2_conn_t* conn)
+{
+    uint64_t now = now_ms();
+
+    conn->connected = true;
+    fprintf(stderr, "Connected to %s\n", conn->hostkey);
+
+    for (transfer_t* t = conn->fetcher->transfers; t != NULL; t = t->next) {
+        if (t->h2conn == conn) {
+            t->connect_time = now;
+            t->state = TRANSFER_RECV_HEADER;
+            transfer_update_timer(t);
+        }
+    }
+}
+
+static void on_h2_conn_event(poll_entry_t* entry, uint32_t events)
+{
+    h2_conn_t* conn = container_of(entry, h2_conn_t, poll);
+    fetcher_t* fetcher = conn->fetcher;
+    int error = 0;
+
+    if (!conn->connected) {
+        socklen_t len = sizeof(error);
+        if (getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+            error = errno;
+        }
+
+        if (error) {
+            net_options_count_failure(fetcher->opts.netopts, error);
+            fprintf(stderr, "%s: Failed to connect: %s\n", conn->hostkey, strerror(error));
+            h2_conn_fail(conn, error);
+            return;
+        }
+
+        on_h2_conn_connected(conn);
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        conn->in_recv = true;
+        error = h2_session_recv(conn->session, fetcher->recvbuf, RECV_BUFFER_SIZE);
+        conn->in_recv = false;
+
+        net_options_rearm(fetcher->opts.netopts, conn->sockfd);
+    }
+
+    if (!error) {
+        error = h2_conn_flush(conn);
+    }
+
+    if (error) {
+        if (error == ECONNRESET && conn->nstreams) {
+            fprintf(stderr, "%s: HTTP/2 connection closed by server\n", conn->hostkey);
+        }
+
+        h2_conn_fail(conn, error);
+    }
+}
+
+static int h2_conn_open(fetcher_t* fetcher, const char* host, const char* port, const char* hostkey, h2_conn_t** out_conn)
+{
+    int error = 0;
+
+    h2_conn_t* conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        return ENOMEM;
+    }
+
+    conn->fetcher = fetcher;
+    conn->sockfd = -1;
+    conn->poll.on_event = on_h2_conn_event;
+    conn->next = fetcher->h2conns;
+    fetcher->h2conns = conn;
+
+    conn->hostkey = strdup(hostkey);
+    if (!conn->hostkey) {
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    bool connected = false;
+    error = connect_socket(fetcher, host, port, &conn->sockfd, &connected);
+    if (error) {
+        goto error_out;
+    }
+
+    ++fetcher->stats.connections;
+
+    error = h2_session_new(&fetcher->opts.h2, &g_h2_callbacks, conn->sockfd, &conn->session);
+    if (error) {
+        goto error_out;
+    }
+
+    error = poll_watch(fetcher, conn->sockfd, &conn->poll, EPOLLOUT, EPOLL_CTL_ADD);
+    if (error) {
+        goto error_out;
+    }
+
+    if (connected) {
+        on_h2_conn_connected(conn);
+    }
+
+    *out_conn = conn;
+    return 0;
+
+error_out:
+    h2_conn_free(conn);
+    return error;
+}
+
+/*
+ * Put transfer on a new stream of shared connection to its host, open one if there is none yet.
+ * Streams over server concurrency limit are held by the session until earlier ones complete.
+ */
+static int h2_transfer_start(transfer_t* t)
+{
+    int error = 0;
+    fetcher_t* fetcher = t->fetcher;
+
+    char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+
+    // Connection that got GOAWAY finishes its streams but takes no more
+    h2_conn_t* conn = fetcher->h2conns;
+    while (conn && (0 != strcmp(conn->hostkey, hostkey) || !h2_can_submit(conn->session))) {
+        conn = conn->next;
+    }
+
+    if (!conn) {
+        error = h2_conn_open(fetcher, t->url.host, t->port, hostkey, &conn);
+        if (error) {
+            return error;
+        }
+    } else {
+        ++fetcher->stats.reused;
+    }
+
+    t->header = malloc(HTTP_HEADER_MAX + 1);
+    if (!t->header) {
+        return ENOMEM;
+    }
+
+    t->header[0] = '\0';
+
+    char authority[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(authority, sizeof(authority), "%s%s%s", t->url.host, (t->url.port ? ":" : ""), (t->url.port ? t->url.port : ""));
+
+    error = h2_submit_get(conn->session, authority, (t->url.target ? t->url.target : "/"), t, &t->stream_id);
+    if (error) {
+        return error;
+    }
+
+    t->h2conn = conn;
+    ++conn->nstreams;
+
+    if (conn->connected) {
+        t->connect_time = now_ms();
+        t->state = TRANSFER_RECV_HEADER;
+    }
+
+    transfer_update_timer(t);
+    return h2_conn_flush(conn);
+}
+
+/*
+ * Transfer is done with its stream, reset it if it has not completed
+ */
+static void h2_transfer_detach(transfer_t* t)
+{
+    h2_conn_t* conn = t->h2conn;
+    if (!conn) {
+        return;
+    }
+
+    if (t->stream_id > 0) {
+        h2_cancel(conn->session, t->stream_id);
+        t->stream_id = 0;
+
+        // Failure shows up with next connection event
+        h2_conn_flush(conn);
+    }
+
+    --conn->nstreams;
+    t->h2conn = NULL;
+}
+
+static int transfer_check_url(transfer_t* t, const char* urlstr);
+
+/*
+ * Target of permanent redirect from URL seen earlier in this run, NULL if there was none
+ */
+static const char* redirect_find(fetcher_t* fetcher, const char* from)
+{
+    if (!fetcher->nredirect_buckets) {
+        return NULL;
+    }
+
+    redirect_entry_t* entry = fetcher->redirects[hash_string(from) & (fetcher->nredirect_buckets - 1)];
+    while (entry && 0 != strcmp(entry->from, from)) {
+        entry = entry->next;
+    }
+
+    return (entry ? entry->to : NULL);
+}
+
+/*
+ * Double redirect cache buckets, first call allocates them
+ */
+static int redirect_grow(fetcher_t* fetcher)
+{
+    size_t nbuckets = (fetcher->nredirect_buckets ? fetcher->nredirect_buckets * 2 : REDIRECT_INITIAL_BUCKETS);
+    redirect_entry_t** buckets = calloc(nbuckets, sizeof(*buckets));
+    if (!buckets) {
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < fetcher->nredirect_buckets; ++i) {
+        while (fetcher->redirects[i]) {
+            redirect_entry_t* entry = fetcher->redirects[i];
+            fetcher->redirects[i] = entry->next;
+
+            size_t index = hash_string(entry->from) & (nbuckets - 1);
+            entry->next = buckets[index];
+            buckets[index] = entry;
+        }
+    }
+
+    free(fetcher->redirects);
+    fetcher->redirects = buckets;
+    fetcher->nredirect_buckets = nbuckets;
+    return 0;
+}
+
+/*
+ * Remember permanent redirect, cache is only an optimization so running out of memory is not an error
+ */
+static void redirect_remember(fetcher_t* fetcher, const char* from, const char* to)
+{
+    if (redirect_find(fetcher, from)) {
+        return;
+    }
+
+    // Growing is best effort, longer chains still work, but there has to be a table to begin with
+    if (fetcher->nredirects >= fetcher->nredirect_buckets) {
+        redirect_grow(fetcher);
+        if (!fetcher->nredirect_buckets) {
+            return;
+        }
+    }
+
+    redirect_entry_t* entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        return;
+    }
+
+    entry->from = strdup(from);
+    entry->to = strdup(to);
+    if (!entry->from || !entry->to) {
+        free(entry->from);
+        free(entry->to);
+        free(entry);
+        return;
+    }
+
+    redirect_entry_t** bucket = &fetcher->redirects[hash_string(from) & (fetcher->nredirect_buckets - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    ++fetcher->nredirects;
+}
+
+/*
+ * Point transfer at new target URL
+ */
+static int transfer_set_target(transfer_t* t, const char* urlstr)
+{
+    char* redirect_url = strdup(urlstr);
+    if (!redirect_url) {
+        return ENOMEM;
+    }
+
+    free(t->redirect_url);
+    t->redirect_url = redirect_url;
+
+    free(t->request);
+    t->request = NULL;
+
+    url_free(&t->url);
+    return transfer_check_url(t, t->redirect_url);
+}
+
+/*
+ * Skip round trips to URLs that have already redirected permanently in this run
+ */
+static int transfer_follow_cached(transfer_t* t)
+{
+    fetcher_t* fetcher = t->fetcher;
+    const char* current = (t->redirect_url ? t->redirect_url : t->urlstr);
+    const char* target = NULL;
+
+    for (const char* to = redirect_find(fetcher, current); to != NULL; to = redirect_find(fetcher, to)) {
+        if (t->redirects >= fetcher->opts.max_redirects) {
+            break;
+        }
+
+        target = to;
+        ++t->redirects;
+        ++fetcher->stats.redirect_cache_hits;
+    }
+
+    if (!target) {
+        return 0;
+    }
+
+    fprintf(stderr, "%s: known to be redirected to %s\n", t->urlstr, target);
+    return transfer_set_target(t, target);
+}
+
+/*
+ * Start connecting to current target host or put transfer on shared HTTP/2 connection to it
+ */
+static int transfer_connect(transfer_t* t)
+{
+    int error = 0;
+
+    t->state = TRANSFER_CONNECTING;
+    t->request_time = now_ms();
+
+    // HTTPS stays on HTTP/1.0, h2 over TLS would need ALPN
+    if (t->fetcher->opts.h2.enabled && !t->https) {
+        return h2_transfer_start(t);
+    }
+
+    bool connected = false;
+    error = connect_socket(t->fetcher, t->url.host, t->port, &t->sockfd, &connected);
+    if (error) {
+        return error;
+    }
+
+    ++t->fetcher->stats.connections;
+
+    error = transfer_watch(t, EPOLLOUT, EPOLL_CTL_ADD);
+    if (error) {
+        return error;
+    }
+
+    if (connected) {
+        return on_connected(t);
+    }
+
+    transfer_update_timer(t);
+    return 0;
+}
+
+/*
+ * Request goes on to another host than the one it was scheduled for. Attempt ends on the old host
+ * and transfer waits for a turn at the new one, its limits and health apply from now on.
+ */
+static int transfer_move(transfer_t* t, sched_result_t result, uint64_t latency)
+{
+    fetcher_t* fetcher = t->fetcher;
+
+    char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+
+    int error = sched_move(fetcher->sched, &t->item, hostkey, result, latency, now_ms());
+    if (error) {
+        return error;
+    }
+
+    // Nothing is written for redirect replies, output file is opened anew when transfer starts again
+    if (t->outfile && t->outfile != stdout) {
+        fclose(t->outfile);
+    }
+
+    t->outfile = NULL;
+    t->state = TRANSFER_QUEUED;
+    timer_cancel(&fetcher->timers, &t->timer);
+    --fetcher->ninflight;
+    return 0;
+}
+
+/*
+ * Open output and start connecting
+ */
+static int transfer_start(transfer_t* t)
+{
+    int error = 0;
+
+    // Transfer that has moved on to another host keeps deadlines of its first request
+    if (!t->start_time) {
+        t->start_time = now_ms();
+    }
+    timer_init(&t->timer, on_transfer_timer);
+
+    error = transfer_follow_cached(t);
+    if (error) {
+        return error;
+    }
+
+    if (!t->request) {
+        error = build_http_get(t);
+        if (error) {
+            return error;
+        }
+    }
+
+    // Cached permanent redirect may point to another host, that host schedules the request
+    char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+    if (0 != strcmp(hostkey, sched_item_host(&t->item))) {
+        return transfer_move(t, SCHED_ABORTED, 0);
+    }
+
+    // Open output file if needed, retry starts it over
+    if (!t->fetcher->opts.archive) {
+        t->outfile = (t->outpath ? fopen(t->outpath, "w+") : stdout);
+        if (!t->outfile) {
+            error = errno;
+            fprintf(stderr, "Could not open output file '%s': %s\n", t->outpath, strerror(error));
+            return error;
+        }
+    }
+
+    return transfer_connect(t);
+}
+
+/*
+ * Redirect reply is complete, send request for its target.
+ * Connection goes on carrying it when target is on the same host and port and server has agreed to keep it open,
+ * HTTP/2 transfers share connection to target host anyway. Target on another host waits for a turn there.
+ * Deadlines keep counting from the first request.
+ */
+static int transfer_redirect(transfer_t* t)
+{
+    int error = 0;
+    fetcher_t* fetcher = t->fetcher;
+
+    char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+    bool https = t->https;
+
+    // Whole body has to be in, otherwise the rest of it would be taken for the next reply
+    bool reuse = (t->sockfd >= 0) && t->keep_alive && (t->total_bytes == t->content_length) &&
+                 !(t->tls && tls_eof(t->tls));
+    uint64_t latency = t->first_byte_time - t->request_time;
+
+    fprintf(stderr, "%s: redirected with %ld to %s\n", t->urlstr, t->status_code, t->location);
+
+    if (t->status_code == 301 || t->status_code == 308) {
+        redirect_remember(fetcher, (t->redirect_url ? t->redirect_url : t->urlstr), t->location);
+    }
+
+    ++t->redirects;
+    ++fetcher->stats.redirects;
+
+    error = transfer_set_target(t, t->location);
+    if (error) {
+        return error;
+    }
+
+    free(t->location);
+    t->location = NULL;
+
+    error = build_http_get(t);
+    if (error) {
+        return error;
+    }
+
+    // Forget previous reply
+    free(t->header);
+    t->header = NULL;
+    t->header_length = t->header_size = 0;
+    t->status_code = 0;
+    t->retry_after = 0;
+    t->content_length = SIZE_MAX;
+    t->keep_alive = false;
+    t->first_byte_time = t->last_read_time = 0;
+    t->rate_window_start = 0;
+    t->rate_window_bytes = t->total_bytes = 0;
+
+    char target_hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(target_hostkey, sizeof(target_hostkey), "%s:%s", t->url.host, t->port);
+
+    if (reuse && (https == t->https) && 0 == strcmp(hostkey, target_hostkey)) {
+        ++fetcher->stats.reused;
+
+        t->connect_time = t->request_time = now_ms();
+        t->state = TRANSFER_SENDING;
+        transfer_update_timer(t);
+
+        error = transfer_watch(t, EPOLLOUT, EPOLL_CTL_MOD);
+        if (error) {
+            return error;
+        }
+
+        return on_writable(t);
+    }
+
+    // Redirect reply was read in full, connection is just not usable for the target
+    h2_transfer_detach(t);
+    tls_close(t->tls, true);
+    t->tls = NULL;
+    t->handshake_time = 0;
+    t->resumed = false;
+
+    if (t->sockfd >= 0) {
+        close(t->sockfd);
+        t->sockfd = -1;
+        t->poll.events = 0;
+    }
+
+    // Redirect reply is a success for its host, target host has its own limits and health
+    if (0 != strcmp(hostkey, target_hostkey)) {
+        return transfer_move(t, SCHED_SUCCESS, latency);
+    }
+
+    return transfer_connect(t);
+}
+
+/*
+ * Periodic statistics output, timer is kept armed for the whole run
+ */
+static void on_stats_timer(timer_entry_t* timer, void* ctx)
+{
+    fetcher_t* fetcher = ctx;
+    uint64_t now = now_ms();
+
+    stats_write(&fetcher->stats, &fetcher->opts.stats, now, fetcher->ninflight, fetcher->nwaiting);
+    timer_schedule(&fetcher->timers, &fetcher->stats_timer, now + fetcher->opts.stats.interval);
+}
+
+/*
+ * Start queued transfers while there is room for them
+ */
+static void start_pending(fetcher_t* fetcher)
+{
+    while (fetcher->ninflight < fetcher->opts.max_inflight)
+    {
+        int error = 0;
+        sched_item_t* item = sched_next(fetcher->sched, now_ms(), &error);
+        if (!item) {
+            break;
+        }
+
+        transfer_t* t = container_of(item, transfer_t, item);
+        if (error) {
+            fprintf(stderr, "%s: host is down, not trying\n", t->urlstr);
+            transfer_complete(t, error);
+            continue;
+        }
+
+        ++fetcher->ninflight;
+
+        error = transfer_start(t);
+        if (error) {
+            transfer_finish(t, error);
+        }
+    }
+}
+
+/*
+ * Check URL is something we can download
+ */
+static int transfer_check_url(transfer_t* t, const char* urlstr)
+{
+    int error = url_parse(t->fetcher->url_parser, urlstr, &t->url);
+    if (error) {
+        fprintf(stderr, "Could not parse URL \'%s\': %s\n", urlstr, strerror(error));
+        return error;
+    }
+
+    // Check for supported scheme (default scheme is http)
+    const char* scheme = (t->url.scheme ? t->url.scheme : "http");
+    t->https = (0 == strcasecmp(scheme, "https"));
+    if (!t->https && 0 != strcasecmp(scheme, "http")) {
+        fprintf(stderr, "Scheme '%s' is not supported\n", scheme);
+        return ENOTSUP;
+    }
+
+    t->port = (t->url.port ? t->url.port : (t->https ? "443" : "80"));
+
+    // Authentication is not supported
+    if (t->url.username || t->url.password) {
+        fprintf(stderr, "Authentication is not supported\n");
+        return ENOTSUP;
+    }
+
+    return 0;
+}
+
+/*************************************************************************************************/
+
+int fetcher_init(const fetch_options_t* opts, fetcher_t** out_fetcher)
+{
+    int error = 0;
+
+    if (!opts || !opts->netopts || !out_fetcher) {
+        return EINVAL;
+    }
+
+    fetcher_t* fetcher = calloc(1, sizeof(*fetcher));
+    if (!fetcher) {
+        return ENOMEM;
+    }
+
+    fetcher->opts = *opts;
+    if (fetcher->opts.max_inflight == 0) {
+        fetcher->opts.max_inflight = 1;
+    }
+
+    fetcher->epfd = -1;
+    timer_wheel_init(&fetcher->timers, now_ms());
+
+    stats_init(&fetcher->stats, now_ms());
+    timer_init(&fetcher->stats_timer, on_stats_timer);
+    if (stats_enabled(&fetcher->opts.stats)) {
+        timer_schedule(&fetcher->timers, &fetcher->stats_timer, now_ms() + fetcher->opts.stats.interval);
+    }
+
+    error = sched_init(&fetcher->opts.sched, &fetcher->sched);
+    if (error) {
+        goto error_out;
+    }
+
+    error = url_parser_init_default(&fetcher->url_parser);
+    if (error) {
+        fprintf(stderr, "Could not initilize url parser: %s\n", strerror(error));
+        goto error_out;
+    }
+
+    const char* reply_regex = "^HTTP/1.[01] ([\\d]+) ([\\w]+)";
+    const char* error_str = NULL;
+    int error_offset = 0;
+
+    fetcher->status_re = pcre_compile(reply_regex, 0, &error_str, &error_offset, NULL);
+    if (!fetcher->status_re) {
+        fprintf(stderr, "Failed to compile regex: %s\n", error_str);
+        error = -1;
+        goto error_out;
+    }
+
+    error = tls_init(&fetcher->opts.tls, &fetcher->tls);
+    if (error) {
+        goto error_out;
+    }
+
+    fetcher->recvbuf = malloc(RECV_BUFFER_SIZE);
+    if (!fetcher->recvbuf) {
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    fetcher->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (fetcher->epfd < 0) {
+        error = errno;
+        perror("epoll_create1 failed");
+        goto error_out;
+    }
+
+    *out_fetcher = fetcher;
+    return 0;
+
+error_out:
+    fetcher_free(fetcher);
+    return error;
+}
+
+void fetcher_free(fetcher_t* fetcher)
+{
+    if (fetcher)
+    {
+        // Transfers are only left if we have bailed out of the run
+        while (fetcher->transfers) {
+            transfer_t* t = fetcher->transfers;
+            tls_close(t->tls, false);
+            if (t->sockfd >= 0) {
+                close(t->sockfd);
+            }
+            if (t->outfile && t->outfile != stdout) {
+                fclose(t->outfile);
+            }
+            transfer_free(t);
+        }
+
+        while (fetcher->h2conns) {
+            h2_conn_free(fetcher->h2conns);
+        }
+
+        for (size_t i = 0; i < fetcher->nredirect_buckets; ++i) {
+            while (fetcher->redirects[i]) {
+                redirect_entry_t* entry = fetcher->redirects[i];
+                fetcher->redirects[i] = entry->next;
+                free(entry->from);
+                free(entry->to);
+                free(entry);
+            }
+        }
+        free(fetcher->redirects);
+
+        sched_free(fetcher->sched);
+
+        if (fetcher->epfd >= 0) {
+            close(fetcher->epfd);
+        }
+
+        if (fetcher->status_re) {
+            pcre_free(fetcher->status_re);
+        }
+
+        tls_free(fetcher->tls);
+        url_parser_free(fetcher->url_parser);
+        free(fetcher->recvbuf);
+
+        memset(fetcher, 0, sizeof(*fetcher));
+        free(fetcher);
+    }
+}
+
+int fetcher_add(fetcher_t* fetcher, const char* urlstr, const char* outpath)
+{
+    int error = 0;
+
+    if (!fetcher || !urlstr) {
+        return EINVAL;
+    }
+
+    transfer_t* t = calloc(1, sizeof(*t));
+    if (!t) {
+        return ENOMEM;
+    }
+
+    t->fetcher = fetcher;
+    t->sockfd = -1;
+    t->content_length = SIZE_MAX;
+    t->poll.on_event = on_transfer_event;
+    timer_init(&t->timer, on_transfer_timer);
+
+    t->next = fetcher->transfers;
+    if (t->next) {
+        t->next->prev = t;
+    }
+    fetcher->transfers = t;
+    ++fetcher->ntransfers;
+
+    t->urlstr = strdup(urlstr);
+    t->outpath = (outpath ? strdup(outpath) : NULL);
+    if (!t->urlstr || (outpath && !t->outpath)) {
+        transfer_free(t);
+        return ENOMEM;
+    }
+
+    // Bad URL fails this transfer only
+    error = transfer_check_url(t, t->urlstr);
+    if (error) {
+        transfer_complete(t, error);
+        return 0;
+    }
+
+    char hostkey[NI_MAXHOST + NI_MAXSERV + 2];
+    snprintf(hostkey, sizeof(hostkey), "%s:%s", t->url.host, t->port);
+
+    error = sched_add(fetcher->sched, &t->item, hostkey);
+    if (error) {
+        transfer_free(t);
+        return error;
+    }
+
+    return 0;
+}
+
+int fetcher_run(fetcher_t* fetcher, size_t* out_nfailed)
+{
+    if (!fetcher) {
+        return EINVAL;
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (1)
+    {
+        start_pending(fetcher);
+        if (fetcher->ninflight == 0 && fetcher->nwaiting == 0) {
+            assert(sched_empty(fetcher->sched));
+            break;
+        }
+
+        int64_t timeout = timer_wheel_timeout(&fetcher->timers, now_ms());
+        int nevents = epoll_wait(fetcher->epfd, events, countof(events), (timeout > INT_MAX ? INT_MAX : (int)timeout));
+        if (nevents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            int error = errno;
+            perror("epoll_wait failed");
+            return error;
+        }
+
+        for (int i = 0; i < nevents; ++i) {
+            poll_entry_t* entry = events[i].data.ptr;
+            entry->on_event(entry, events[i].events);
+        }
+
+        timer_wheel_advance(&fetcher->timers, now_ms(), fetcher);
+    }
+
+    if (fetcher->ntransfers > 1) {
+        sched_print_stats(fetcher->sched);
+    }
+
+    tls_print_stats(fetcher->tls);
+
+    // Final numbers, whatever the interval
+    if (stats_enabled(&fetcher->opts.stats)) {
+        timer_cancel(&fetcher->timers, &fetcher->stats_timer);
+        stats_write(&fetcher->stats, &fetcher->opts.stats, now_ms(), fetcher->ninflight, fetcher->nwaiting);
+    }
+
+    if (out_nfailed) {
+        *out_nfailed = fetcher->nfailed;
+    }
+
+    return fetcher->first_error;
+}
+
+/*************************************************************************************************/
@@ -0,0 +1,119 @@
+/**
+ * @file fetch.h
+ *
+ * Event driven HTTP transfer engine
+ */
+
+#ifndef _HTTPGET_FETCH_H_
+#define _HTTPGET_FETCH_H_
+
+#include "netopt.h"
+#include "hostsched.h"
+#include "archive.h"
+#include "tls.h"
+#include "h2.h"
+#include "stats.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Transfer engine opaque context
+ */
+typedef struct fetcher fetcher_t;
+
+/**
+ * @brief   Transfer engine options
+ *
+ *          All timeouts are in milliseconds, 0 disables the corresponding deadline.
+ */
+typedef struct fetch_options
+{
+    net_options_t* netopts;         // Options for outgoing sockets
+
+    size_t max_inflight;            // Maximum number of concurrent transfers
+
+    unsigned connect_timeout;       // From start of connect until connection is established, TLS handshake included
+    unsigned first_byte_timeout;    // From connection established until first reply byte
+    unsigned idle_timeout;          // Maximum gap between two reads
+    unsigned total_timeout;         // Whole transfer including connect
+
+    unsigned max_redirects;         // Redirect hops to follow, 0 to fail on redirect
+
+    unsigned long min_rate;         // Minimum transfer rate in bytes per second once reply started, 0 to disable
+    unsigned min_rate_period;       // Window over which transfer rate is averaged
+
+    sched_options_t sched;          // Per host concurrency, retries and circuit breaking
+    tls_options_t tls;              // HTTPS certificate verification, session resumption and kTLS
+    h2_options_t h2;                // HTTP/2 streams over one connection per host instead of connection per URL
+    stats_options_t stats;          // Periodic counters and latency quantiles output
+
+    archive_t* archive;             // Store successful replies here instead of output files, NULL to disable
+} fetch_options_t;
+
+/**
+ * @brief       Init options with defaults: one transfer at a time, no deadlines, no retries, up to 5 redirects.
+ *              Options have to be freed with @fetch_options_free@
+ */
+void fetch_options_init(fetch_options_t* opts, net_options_t* netopts);
+
+/**
+ * @brief       Parse timeouts specification: comma separated list of
+ *              connect=<ms>, firstbyte=<ms>, idle=<ms>, total=<ms>, minrate=<bytes/s>, rateperiod=<ms>
+ *
+ * @returns     0 on success, EINVAL if specification contains unknown option or invalid value
+ */
+int fetch_options_parse_timeouts(fetch_options_t* opts, const char* spec);
+
+/**
+ * @brief       Free all resources associated with these options.
+ */
+void fetch_options_free(fetch_options_t* opts);
+
+/**
+ * @brief       Create transfer engine.
+ *
+ * @opts        Options are copied, netopts pointer is kept and has to outlive the engine.
+ * @out_fetcher On success will contain pointer to engine.
+ *              Caller is responsible to free it using @fetcher_free@
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int fetcher_init(const fetch_options_t* opts, fetcher_t** out_fetcher);
+
+/**
+ * @brief       Free all resources associated with this engine.
+ */
+void fetcher_free(fetcher_t* fetcher);
+
+/**
+ * @brief       Queue URL for download.
+ *
+ * @urlstr      URL to download
+ * @outpath     File to store contents in, NULL for stdout. File is created only when transfer starts.
+ *              Ignored when engine stores replies in archive.
+ *
+ * @returns     0 on success, ENOMEM if there was no memory.
+ *              URLs that can not be downloaded are reported right away and counted as failed transfers.
+ */
+int fetcher_add(fetcher_t* fetcher, const char* urlstr, const char* outpath);
+
+/**
+ * @brief       Run all queued transfers to completion.
+ *
+ * @out_nfailed Optional, number of failed transfers.
+ *
+ * @returns     0 if all transfers succeeded, error of the first failed transfer otherwise.
+ *              Transfers that missed a deadline fail with ETIMEDOUT, including TLS handshake in connect phase,
+ *              transfers to hosts with open circuit breaker fail with EHOSTDOWN,
+ *              transfers that went over redirect limit fail with ELOOP.
+ */
+int fetcher_run(fetcher_t* fetcher, size_t* out_nfailed);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+
+#include "h2.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <nghttp2/nghttp2.h>
+
+/*************************************************************************************/
+
+#if !defined(countof)
+#   define countof(_arr_)   (sizeof((_arr_)) / sizeof(*(_arr_)))
+#endif
+
+// Frames are gathered up to this size before they go to socket
+#define H2_SEND_CHUNK_SIZE      65536
+
+struct h2_session
+{
+    nghttp2_session* session;
+    h2_callbacks_t callbacks;
+    int sockfd;
+
+    char* sendbuf;                  // Serialized frames socket has not taken yet
+    size_t sendlen;
+    size_t sendsize;
+};
+
+/*************************************************************************************/
+
+void h2_options_init(h2_options_t* opts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->window = 1 << 20;
+    opts->conn_window = 16 << 20;
+}
+
+int h2_options_parse(h2_options_t* opts, const char* spec)
+{
+    int error = 0;
+
+    if (!opts || !spec) {
+        return EINVAL;
+    }
+
+    char* list = strdup(spec);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        if (0 == strcmp(name, "h2c") && !valstr) {
+            opts->enabled = true;
+            continue;
+        } else if (0 == strcmp(name, "http1") && !valstr) {
+            opts->enabled = false;
+            continue;
+        }
+
+        // HTTP/2 windows are 31 bit, minimum is the default 64 KB less one byte
+        char* end = NULL;
+        long value = (valstr ? strtol(valstr, &end, 10) : -1);
+        if (!valstr || *end != '\0' || value < NGHTTP2_INITIAL_WINDOW_SIZE || value > NGHTTP2_MAX_WINDOW_SIZE) {
+            fprintf(stderr, "Invalid value for protocol option '%s'\n", name);
+            error = EINVAL;
+            break;
+        }
+
+        if (0 == strcmp(name, "window")) {
+            opts->window = value;
+        } else if (0 == strcmp(name, "connwindow")) {
+            opts->conn_window = value;
+        } else {
+            fprintf(stderr, "Unknown protocol option '%s'\n", name);
+            error = EINVAL;
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+/*************************************************************************************/
+
+static int on_header(nghttp2_session* ngsession, const nghttp2_frame* frame,
+                     const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen,
+                     uint8_t flags, void* user_data)
+{
+    h2_session_t* session = user_data;
+
+    if (frame->hd.type == NGHTTP2_HEADERS) {
+        void* stream_ctx = nghttp2_session_get_stream_user_data(ngsession, frame->hd.stream_id);
+        if (stream_ctx) {
+            session->callbacks.on_header(stream_ctx, (const char*)name, namelen, (const char*)value, valuelen);
+        }
+    }
+
+    return 0;
+}
+
+static int on_frame_recv(nghttp2_session* ngsession, const nghttp2_frame* frame, void* user_data)
+{
+    h2_session_t* session = user_data;
+
+    if (frame->hd.type == NGHTTP2_HEADERS && (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS)) {
+        void* stream_ctx = nghttp2_session_get_stream_user_data(ngsession, frame->hd.stream_id);
+        if (stream_ctx) {
+            session->callbacks.on_headers_done(stream_ctx);
+        }
+    }
+
+    return 0;
+}
+
+static int on_data_chunk(nghttp2_session* ngsession, uint8_t flags, int32_t stream_id,
+                         const uint8_t* data, size_t len, void* user_data)
+{
+    h2_session_t* session = user_data;
+
+    void* stream_ctx = nghttp2_session_get_stream_user_data(ngsession, stream_id);
+    if (stream_ctx) {
+        session->callbacks.on_data(stream_ctx, (const char*)data, len);
+    }
+
+    return 0;
+}
+
+static int on_stream_close(nghttp2_session* ngsession, int32_t stream_id, uint32_t error_code, void* user_data)
+{
+    h2_session_t* session = user_data;
+
+    void* stream_ctx = nghttp2_session_get_stream_user_data(ngsession, stream_id);
+    if (!stream_ctx) {
+        return 0;
+    }
+
+    int error = 0;
+    if (error_code == NGHTTP2_REFUSED_STREAM) {
+        // Server has not processed the request at all
+        error = ECONNREFUSED;
+    } else if (error_code != NGHTTP2_NO_ERROR) {
+        fprintf(stderr, "HTTP/2 stream %d reset: %s\n", stream_id, nghttp2_http2_strerror(error_code));
+        error = ECONNRESET;
+    }
+
+    session->callbacks.on_stream_close(stream_ctx, error);
+    return 0;
+}
+
+/*************************************************************************************/
+
+int h2_session_new(const h2_options_t* opts, const h2_callbacks_t* callbacks, int sockfd, h2_session_t** out_session)
+{
+    int error = 0;
+
+    if (!opts || !callbacks || sockfd < 0 || !out_session) {
+        return EINVAL;
+    }
+
+    h2_session_t* session = calloc(1, sizeof(*session));
+    if (!session) {
+        return ENOMEM;
+    }
+
+    session->callbacks = *callbacks;
+    session->sockfd = sockfd;
+
+    nghttp2_session_callbacks* ngcallbacks = NULL;
+    if (nghttp2_session_callbacks_new(&ngcallbacks)) {
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    nghttp2_session_callbacks_set_on_header_callback(ngcallbacks, on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(ngcallbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(ngcallbacks, on_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback(ngcallbacks, on_stream_close);
+
+    int res = nghttp2_session_client_new(&session->session, ngcallbacks, session);
+    nghttp2_session_callbacks_del(ngcallbacks);
+    if (res) {
+        session->session = NULL;
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    // Default 64 KB windows stall a single stream at 64 KB per round trip, open them up front
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, opts->window },
+    };
+
+    res = nghttp2_submit_settings(session->session, NGHTTP2_FLAG_NONE, settings, countof(settings));
+    if (!res) {
+        res = nghttp2_session_set_local_window_size(session->session, NGHTTP2_FLAG_NONE, 0, opts->conn_window);
+    }
+
+    if (res) {
+        fprintf(stderr, "Failed to set up HTTP/2 session: %s\n", nghttp2_strerror(res));
+        error = EPROTO;
+        goto error_out;
+    }
+
+    *out_session = session;
+    return 0;
+
+error_out:
+    h2_session_free(session);
+    return error;
+}
+
+void h2_session_free(h2_session_t* session)
+{
+    if (session)
+    {
+        if (session->session) {
+            nghttp2_session_del(session->session);
+        }
+
+        free(session->sendbuf);
+        free(session);
+    }
+}
+
+int h2_submit_get(h2_session_t* session, const char* authority, const char* path, void* stream_ctx, int32_t* out_stream_id)
+{
+    if (!session || !authority || !path || !stream_ctx || !out_stream_id) {
+        return EINVAL;
+    }
+
+    if (!h2_can_submit(session)) {
+        return EAGAIN;
+    }
+
+    #define make_nv(_name_, _value_) \
+        { (uint8_t*)(_name_), (uint8_t*)(_value_), strlen(_name_), strlen(_value_), NGHTTP2_NV_FLAG_NONE }
+
+    const nghttp2_nv headers[] = {
+        make_nv(":method", "GET"),
+        make_nv(":scheme", "http"),
+        make_nv(":authority", authority),
+        make_nv(":path", path),
+    };
+
+    #undef make_nv
+
+    int32_t stream_id = nghttp2_submit_request(session->session, NULL, headers, countof(headers), NULL, stream_ctx);
+    if (stream_id < 0) {
+        fprintf(stderr, "Failed to submit HTTP/2 request: %s\n", nghttp2_strerror(stream_id));
+        return (stream_id == NGHTTP2_ERR_STREAM_ID_NOT_AVAILABLE ? EAGAIN : EPROTO);
+    }
+
+    *out_stream_id = stream_id;
+    return 0;
+}
+
+void h2_cancel(h2_session_t* session, int32_t stream_id)
+{
+    assert(session != NULL);
+
+    nghttp2_session_set_stream_user_data(session->session, stream_id, NULL);
+    nghttp2_submit_rst_stream(session->session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+}
+
+bool h2_can_submit(h2_session_t* session)
+{
+    return nghttp2_session_check_request_allowed(session->session);
+}
+
+int h2_session_recv(h2_session_t* session, char* buf, size_t size)
+{
+    assert(session != NULL);
+
+    ssize_t nbytes = recv(session->sockfd, buf, size, 0);
+    if (nbytes == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        int error = errno;
+        fprintf(stderr, "HTTP/2 recv failed: %s\n", strerror(error));
+        return error;
+    }
+    else if (nbytes == 0) {
+        return ECONNRESET;
+    }
+
+    ssize_t res = nghttp2_session_mem_recv(session->session, (const uint8_t*)buf, nbytes);
+    if (res < 0) {
+        fprintf(stderr, "HTTP/2 protocol error: %s\n", nghttp2_strerror(res));
+        return EPROTO;
+    }
+
+    return 0;
+}
+
+/*
+ * Serialize queued frames into send buffer. Frames are small and many, sending them one by one
+ * would cost a syscall each and with Nagle would hold request behind the connection preface.
+ */
+static int gather_frames(h2_session_t* session)
+{
+    while (session->sendlen < H2_SEND_CHUNK_SIZE)
+    {
+        const uint8_t* data = NULL;
+        ssize_t len = nghttp2_session_mem_send(session->session, &data);
+        if (len < 0) {
+            fprintf(stderr, "HTTP/2 send failed: %s\n", nghttp2_strerror(len));
+            return EPROTO;
+        } else if (len == 0) {
+            break;
+        }
+
+        if (session->sendlen + len > session->sendsize) {
+            size_t sendsize = session->sendlen + len + H2_SEND_CHUNK_SIZE;
+            char* sendbuf = realloc(session->sendbuf, sendsize);
+            if (!sendbuf) {
+                return ENOMEM;
+            }
+
+            session->sendbuf = sendbuf;
+            session->sendsize = sendsize;
+        }
+
+        memcpy(session->sendbuf + session->sendlen, data, len);
+        session->sendlen += len;
+    }
+
+    return 0;
+}
+
+int h2_session_send(h2_session_t* session)
+{
+    assert(session != NULL);
+
+    while (1)
+    {
+        int error = gather_frames(session);
+        if (error) {
+            return error;
+        }
+
+        if (session->sendlen == 0) {
+            return 0;
+        }
+
+        ssize_t res = send(session->sockfd, session->sendbuf, session->sendlen, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+
+            error = errno;
+            fprintf(stderr, "HTTP/2 send failed: %s\n", strerror(error));
+            return error;
+        }
+
+        memmove(session->sendbuf, session->sendbuf + res, session->sendlen - res);
+        session->sendlen -= res;
+    }
+}
+
+bool h2_want_write(h2_session_t* session)
+{
+    return session->sendlen > 0 || nghttp2_session_want_write(session->session);
+}
+
+/*************************************************************************************/
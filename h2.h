@@ -0,0 +1,116 @@
+/**
+ * @file h2.h
+ *
+ * Cleartext HTTP/2 client sessions with prior knowledge over non-blocking sockets
+ */
+
+#ifndef _HTTPGET_H2_H_
+#define _HTTPGET_H2_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   HTTP/2 options
+ */
+typedef struct h2_options
+{
+    bool enabled;                   // Use h2c for http URLs instead of one HTTP/1.0 connection per URL
+    int32_t window;                 // Per stream receive window in bytes
+    int32_t conn_window;            // Connection receive window in bytes
+} h2_options_t;
+
+/**
+ * @brief   Session events, @stream_ctx@ is what was given to @h2_submit_get@.
+ *          Callbacks may call @h2_cancel@ but must not free the session.
+ */
+typedef struct h2_callbacks
+{
+    void (*on_header)(void* stream_ctx, const char* name, size_t namelen, const char* value, size_t valuelen);
+    void (*on_headers_done)(void* stream_ctx);
+    void (*on_data)(void* stream_ctx, const char* data, size_t size);
+    void (*on_stream_close)(void* stream_ctx, int error);
+} h2_callbacks_t;
+
+/**
+ * @brief   HTTP/2 session opaque context
+ */
+typedef struct h2_session h2_session_t;
+
+/**
+ * @brief       Init options with defaults: disabled, 1 MB stream window, 16 MB connection window.
+ */
+void h2_options_init(h2_options_t* opts);
+
+/**
+ * @brief       Parse protocol specification: comma separated list of
+ *              http1 or h2c, window=<bytes>, connwindow=<bytes>
+ *
+ * @returns     0 on success, EINVAL if specification contains unknown option or invalid value
+ */
+int h2_options_parse(h2_options_t* opts, const char* spec);
+
+/**
+ * @brief       Create client session on connected socket. Connection preface and our settings
+ *              are queued right away and go out with the first @h2_session_send@.
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int h2_session_new(const h2_options_t* opts, const h2_callbacks_t* callbacks, int sockfd, h2_session_t** out_session);
+
+/**
+ * @brief       Free session, socket is left to the caller.
+ */
+void h2_session_free(h2_session_t* session);
+
+/**
+ * @brief       Queue GET request on a new stream. Streams above server concurrency limit wait inside session.
+ *
+ * @authority   Host and optional port
+ * @path        Absolute path with query
+ * @stream_ctx  Passed to callbacks of this stream
+ *
+ * @returns     0 on success, EAGAIN if session does not take new streams anymore, errno value on failure.
+ */
+int h2_submit_get(h2_session_t* session, const char* authority, const char* path, void* stream_ctx, int32_t* out_stream_id);
+
+/**
+ * @brief       Reset stream, its callbacks are not called anymore.
+ */
+void h2_cancel(h2_session_t* session, int32_t stream_id);
+
+/**
+ * @brief       True if session takes new streams, false once server has sent GOAWAY.
+ */
+bool h2_can_submit(h2_session_t* session);
+
+/**
+ * @brief       Read from socket once and process received frames.
+ *
+ * @buf         Scratch buffer to read into
+ *
+ * @returns     0 on success, ECONNRESET if server has closed connection, errno value on failure.
+ */
+int h2_session_recv(h2_session_t* session, char* buf, size_t size);
+
+/**
+ * @brief       Send as much of pending frames as socket takes.
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int h2_session_send(h2_session_t* session);
+
+/**
+ * @brief       True if there are frames waiting for socket to become writable.
+ */
+bool h2_want_write(h2_session_t* session);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
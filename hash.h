@@ -0,0 +1,34 @@
+/**
+ * @file hash.h
+ *
+ * String hash shared by lookup tables and archive index
+ */
+
+#ifndef _HTTPGET_HASH_H_
+#define _HTTPGET_HASH_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief       64 bit FNV-1a of NUL terminated string.
+ *              Archive index stores these values, so the function must not change.
+ */
+static inline uint64_t hash_string(const char* str)
+{
+    uint64_t hash = 14695981039346656037ull;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+
+#include "hostsched.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/*************************************************************************************/
+
+#define SCHED_INITIAL_BUCKETS       64
+
+// Latency above twice the best seen plus this slack is taken as a sign of host congestion
+#define SCHED_LATENCY_SLACK_MS      20
+
+// Open breaker cooldown doubles on every failed probe up to this many times the configured one
+#define SCHED_MAX_COOLDOWN_FACTOR   16
+
+typedef enum breaker_state
+{
+    BREAKER_CLOSED,                 // Requests flow normally
+    BREAKER_OPEN,                   // Requests fail right away until cooldown expires
+    BREAKER_HALF_OPEN,              // Single probe request is let through
+} breaker_state_t;
+
+struct sched_host
+{
+    struct sched_host* hash_next;
+    struct sched_host* all_next;    // All hosts in order of appearance
+    struct sched_host* run_prev;    // Runnable hosts list links
+    struct sched_host* run_next;
+    bool runnable;
+
+    char* key;
+
+    sched_item_t* queue_head;
+    sched_item_t** queue_tail;
+    size_t inflight;
+
+    double limit;                   // AIMD concurrency limit
+    double ssthresh;                // Limit grows exponentially below this and linearly above
+    unsigned epoch;
+    uint64_t min_latency;
+
+    breaker_state_t breaker;
+    unsigned consecutive_failures;
+    unsigned cooldown;
+    uint64_t open_until;
+
+    size_t nsuccess;
+    size_t nfailure;
+    size_t nfastfail;
+    size_t nbreaker_opened;
+};
+
+struct sched
+{
+    sched_options_t opts;
+
+    sched_host_t** buckets;
+    size_t nbuckets;
+    size_t nhosts;
+
+    sched_host_t* all_head;
+    sched_host_t** all_tail;
+
+    sched_host_t* run_head;
+    sched_host_t* run_tail;
+
+    size_t nqueued;
+    unsigned seed;
+};
+
+/*************************************************************************************/
+
+void sched_options_init(sched_options_t* opts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->max_per_host = 16;
+    opts->backoff_base = 100;
+    opts->backoff_max = 10000;
+    opts->breaker_cooldown = 5000;
+}
+
+int sched_options_parse(sched_options_t* opts, const char* spec)
+{
+    int error = 0;
+
+    if (!opts || !spec) {
+        return EINVAL;
+    }
+
+    char* list = strdup(spec);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        char* end = NULL;
+        long value = (valstr ? strtol(valstr, &end, 10) : -1);
+        if (!valstr || *end != '\0' || value < 0 || value > INT_MAX) {
+            fprintf(stderr, "Invalid value for host option '%s'\n", name);
+            error = EINVAL;
+            break;
+        }
+
+        if (0 == strcmp(name, "maxconn") && value > 0) {
+            opts->max_per_host = value;
+        } else if (0 == strcmp(name, "retries")) {
+            opts->max_retries = value;
+        } else if (0 == strcmp(name, "backoff")) {
+            opts->backoff_base = value;
+        } else if (0 == strcmp(name, "maxbackoff")) {
+            opts->backoff_max = value;
+        } else if (0 == strcmp(name, "breaker")) {
+            opts->breaker_threshold = value;
+        } else if (0 == strcmp(name, "cooldown")) {
+            opts->breaker_cooldown = value;
+        } else {
+            fprintf(stderr, "Unknown host option '%s'\n", name);
+            error = EINVAL;
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+/*************************************************************************************/
+
+static int grow_buckets(sched_t* sched)
+{
+    size_t nbuckets = sched->nbuckets * 2;
+    sched_host_t** buckets = calloc(nbuckets, sizeof(*buckets));
+    if (!buckets) {
+        return ENOMEM;
+    }
+
+    for (sched_host_t* host = sched->all_head; host != NULL; host = host->all_next) {
+        size_t index = hash_string(host->key) & (nbuckets - 1);
+        host->hash_next = buckets[index];
+        buckets[index] = host;
+    }
+
+    free(sched->buckets);
+    sched->buckets = buckets;
+    sched->nbuckets = nbuckets;
+    return 0;
+}
+
+/*
+ * Find host by key, create it if there is none yet
+ */
+static sched_host_t* get_host(sched_t* sched, const char* hostkey)
+{
+    size_t hash = hash_string(hostkey);
+    for (sched_host_t* host = sched->buckets[hash & (sched->nbuckets - 1)]; host != NULL; host = host->hash_next) {
+        if (0 == strcmp(host->key, hostkey)) {
+            return host;
+        }
+    }
+
+    // Growing is best effort, longer chains still work
+    if (sched->nhosts >= sched->nbuckets) {
+        grow_buckets(sched);
+    }
+
+    sched_host_t* host = calloc(1, sizeof(*host));
+    if (!host) {
+        return NULL;
+    }
+
+    host->key = strdup(hostkey);
+    if (!host->key) {
+        free(host);
+        return NULL;
+    }
+
+    host->queue_tail = &host->queue_head;
+    host->limit = 1;
+    host->ssthresh = sched->opts.max_per_host;
+    host->min_latency = UINT64_MAX;
+    host->cooldown = sched->opts.breaker_cooldown;
+
+    size_t index = hash & (sched->nbuckets - 1);
+    host->hash_next = sched->buckets[index];
+    sched->buckets[index] = host;
+
+    *sched->all_tail = host;
+    sched->all_tail = &host->all_next;
+    ++sched->nhosts;
+
+    return host;
+}
+
+static size_t host_limit(const sched_host_t* host)
+{
+    return (host->breaker == BREAKER_HALF_OPEN ? 1 : (size_t)host->limit);
+}
+
+/*
+ * Host is runnable when it has queued items and either room for one more or items to fail fast
+ */
+static void update_runnable(sched_t* sched, sched_host_t* host)
+{
+    bool runnable = (host->queue_head != NULL) &&
+                    ((host->breaker == BREAKER_OPEN) || (host->inflight < host_limit(host)));
+
+    if (runnable == host->runnable) {
+        return;
+    }
+
+    if (runnable) {
+        host->run_prev = sched->run_tail;
+        host->run_next = NULL;
+        if (sched->run_tail) {
+            sched->run_tail->run_next = host;
+        } else {
+            sched->run_head = host;
+        }
+        sched->run_tail = host;
+    } else {
+        if (host->run_prev) {
+            host->run_prev->run_next = host->run_next;
+        } else {
+            sched->run_head = host->run_next;
+        }
+
+        if (host->run_next) {
+            host->run_next->run_prev = host->run_prev;
+        } else {
+            sched->run_tail = host->run_prev;
+        }
+
+        host->run_prev = host->run_next = NULL;
+    }
+
+    host->runnable = runnable;
+}
+
+/*
+ * Congestion signal: halve the limit, once per epoch so a burst of failures of
+ * concurrently started requests only counts once
+ */
+static void decrease_limit(sched_host_t* host, const sched_item_t* item)
+{
+    if (item->epoch != host->epoch) {
+        return;
+    }
+
+    host->ssthresh = (host->limit / 2 > 1 ? host->limit / 2 : 1);
+    host->limit = host->ssthresh;
+    ++host->epoch;
+}
+
+static void increase_limit(const sched_t* sched, sched_host_t* host)
+{
+    if (host->limit < host->ssthresh) {
+        host->limit += 1;
+    } else {
+        host->limit += 1 / host->limit;
+    }
+
+    if (host->limit > sched->opts.max_per_host) {
+        host->limit = sched->opts.max_per_host;
+    }
+}
+
+static void open_breaker(sched_host_t* host, uint64_t now)
+{
+    host->breaker = BREAKER_OPEN;
+    host->open_until = now + host->cooldown;
+    ++host->nbreaker_opened;
+
+    fprintf(stderr, "%s: circuit breaker open for %u ms after %u failures\n",
+            host->key, host->cooldown, host->consecutive_failures);
+}
+
+/*************************************************************************************/
+
+int sched_init(const sched_options_t* opts, sched_t** out_sched)
+{
+    if (!opts || !out_sched) {
+        return EINVAL;
+    }
+
+    sched_t* sched = calloc(1, sizeof(*sched));
+    if (!sched) {
+        return ENOMEM;
+    }
+
+    sched->opts = *opts;
+    if (sched->opts.max_per_host == 0) {
+        sched->opts.max_per_host = 1;
+    }
+
+    sched->all_tail = &sched->all_head;
+    sched->seed = (unsigned)time(NULL) ^ (unsigned)getpid();
+
+    sched->nbuckets = SCHED_INITIAL_BUCKETS;
+    sched->buckets = calloc(sched->nbuckets, sizeof(*sched->buckets));
+    if (!sched->buckets) {
+        free(sched);
+        return ENOMEM;
+    }
+
+    *out_sched = sched;
+    return 0;
+}
+
+void sched_free(sched_t* sched)
+{
+    if (sched)
+    {
+        sched_host_t* host = sched->all_head;
+        while (host) {
+            sched_host_t* next = host->all_next;
+            free(host->key);
+            free(host);
+            host = next;
+        }
+
+        free(sched->buckets);
+
+        memset(sched, 0, sizeof(*sched));
+        free(sched);
+    }
+}
+
+int sched_add(sched_t* sched, sched_item_t* item, const char* hostkey)
+{
+    assert(sched != NULL);
+    assert(item != NULL);
+
+    sched_host_t* host = get_host(sched, hostkey);
+    if (!host) {
+        return ENOMEM;
+    }
+
+    item->host = host;
+    item->next = NULL;
+    *host->queue_tail = item;
+    host->queue_tail = &item->next;
+    ++sched->nqueued;
+
+    update_runnable(sched, host);
+    return 0;
+}
+
+void sched_requeue(sched_t* sched, sched_item_t* item)
+{
+    assert(sched != NULL);
+    assert(item != NULL && item->host != NULL);
+
+    sched_host_t* host = item->host;
+
+    item->next = host->queue_head;
+    host->queue_head = item;
+    if (host->queue_tail == &host->queue_head) {
+        host->queue_tail = &item->next;
+    }
+    ++sched->nqueued;
+
+    update_runnable(sched, host);
+}
+
+sched_item_t* sched_next(sched_t* sched, uint64_t now, int* out_error)
+{
+    assert(sched != NULL);
+    assert(out_error != NULL);
+
+    while (sched->run_head)
+    {
+        sched_host_t* host = sched->run_head;
+
+        // Cooldown is over, let a probe through
+        if (host->breaker == BREAKER_OPEN && now >= host->open_until) {
+            host->breaker = BREAKER_HALF_OPEN;
+        }
+
+        if (host->breaker != BREAKER_OPEN && host->inflight >= host_limit(host)) {
+            update_runnable(sched, host);
+            continue;
+        }
+
+        sched_item_t* item = host->queue_head;
+        host->queue_head = item->next;
+        if (!host->queue_head) {
+            host->queue_tail = &host->queue_head;
+        }
+        item->next = NULL;
+        --sched->nqueued;
+
+        if (host->breaker == BREAKER_OPEN) {
+            ++host->nfastfail;
+            *out_error = EHOSTDOWN;
+        } else {
+            ++host->inflight;
+            ++item->attempts;
+            item->epoch = host->epoch;
+            *out_error = 0;
+        }
+
+        // Move host to the back of the line
+        host->runnable = false;
+        if (host->run_next) {
+            sched->run_head = host->run_next;
+            sched->run_head->run_prev = NULL;
+        } else {
+            sched->run_head = sched->run_tail = NULL;
+        }
+        host->run_next = NULL;
+        update_runnable(sched, host);
+
+        return item;
+    }
+
+    return NULL;
+}
+
+void sched_done(sched_t* sched, sched_item_t* item, sched_result_t result, uint64_t latency, uint64_t now)
+{
+    assert(sched != NULL);
+    assert(item != NULL && item->host != NULL);
+
+    sched_host_t* host = item->host;
+
+    assert(host->inflight > 0);
+    --host->inflight;
+
+    if (result == SCHED_SUCCESS)
+    {
+        ++host->nsuccess;
+        host->consecutive_failures = 0;
+
+        if (host->breaker == BREAKER_HALF_OPEN) {
+            host->breaker = BREAKER_CLOSED;
+            host->cooldown = sched->opts.breaker_cooldown;
+        }
+
+        bool congested = (host->min_latency != UINT64_MAX) &&
+                         (latency > 2 * host->min_latency + SCHED_LATENCY_SLACK_MS);
+
+        if (latency < host->min_latency) {
+            host->min_latency = latency;
+        }
+
+        if (congested) {
+            decrease_limit(host, item);
+        } else {
+            increase_limit(sched, host);
+        }
+    }
+    else if (result == SCHED_FAILURE)
+    {
+        ++host->nfailure;
+        ++host->consecutive_failures;
+        decrease_limit(host, item);
+
+        if (host->breaker == BREAKER_HALF_OPEN) {
+            // Probe failed, back off longer
+            if (host->cooldown < sched->opts.breaker_cooldown * SCHED_MAX_COOLDOWN_FACTOR) {
+                host->cooldown *= 2;
+            }
+            open_breaker(host, now);
+        } else if (host->breaker == BREAKER_CLOSED && sched->opts.breaker_threshold &&
+                   host->consecutive_failures >= sched->opts.breaker_threshold) {
+            open_breaker(host, now);
+        }
+    }
+
+    update_runnable(sched, host);
+}
+
+int sched_move(sched_t* sched, sched_item_t* item, const char* hostkey, sched_result_t result, uint64_t latency, uint64_t now)
+{
+    assert(sched != NULL);
+    assert(item != NULL && item->host != NULL);
+
+    // Only failure is running out of memory for new host, find out before touching the old one
+    if (!get_host(sched, hostkey)) {
+        return ENOMEM;
+    }
+
+    sched_done(sched, item, result, latency, now);
+
+    item->attempts = 0;
+    return sched_add(sched, item, hostkey);
+}
+
+const char* sched_item_host(const sched_item_t* item)
+{
+    assert(item != NULL && item->host != NULL);
+    return item->host->key;
+}
+
+uint64_t sched_backoff(sched_t* sched, const sched_item_t* item)
+{
+    assert(sched != NULL);
+    assert(item != NULL);
+
+    uint64_t backoff = sched->opts.backoff_base;
+    for (unsigned i = 1; i < item->attempts && backoff < sched->opts.backoff_max; ++i) {
+        backoff *= 2;
+    }
+
+    if (backoff > sched->opts.backoff_max) {
+        backoff = sched->opts.backoff_max;
+    }
+
+    // Half fixed, half random so retries of requests that failed together spread out
+    return backoff / 2 + (backoff ? (uint64_t)rand_r(&sched->seed) % (backoff / 2 + 1) : 0);
+}
+
+bool sched_empty(const sched_t* sched)
+{
+    assert(sched != NULL);
+    return sched->nqueued == 0;
+}
+
+void sched_print_stats(const sched_t* sched)
+{
+    assert(sched != NULL);
+
+    for (const sched_host_t* host = sched->all_head; host != NULL; host = host->all_next) {
+        fprintf(stderr, "%s: %zu replied, %zu failed, %zu failed fast, breaker opened %zu times, concurrency limit %zu\n",
+                host->key, host->nsuccess, host->nfailure, host->nfastfail, host->nbreaker_opened, (size_t)host->limit);
+    }
+}
+
+/*************************************************************************************/
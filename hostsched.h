@@ -0,0 +1,148 @@
+/**
+ * @file hostsched.h
+ *
+ * Per host transfer scheduler: adaptive concurrency limits and circuit breaking
+ */
+
+#ifndef _HTTPGET_HOSTSCHED_H_
+#define _HTTPGET_HOSTSCHED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Scheduler opaque context
+ */
+typedef struct sched sched_t;
+
+/**
+ * @brief   Per host state, opaque
+ */
+typedef struct sched_host sched_host_t;
+
+/**
+ * @brief   Scheduler options
+ */
+typedef struct sched_options
+{
+    size_t max_per_host;            // Upper bound of adaptive per host concurrency limit
+    unsigned max_retries;           // Retries of a failed request, 0 to disable
+    unsigned backoff_base;          // Retry backoff in milliseconds, doubled on every attempt
+    unsigned backoff_max;           // Cap of retry backoff and of honoured Retry-After
+    unsigned breaker_threshold;     // Consecutive failures that open host circuit breaker, 0 to disable
+    unsigned breaker_cooldown;      // Milliseconds before open breaker lets a probe request through
+} sched_options_t;
+
+/**
+ * @brief   Schedulable request, meant to be embedded into the object it schedules
+ */
+typedef struct sched_item
+{
+    struct sched_item* next;        // Host queue link
+    sched_host_t* host;
+    unsigned attempts;              // Number of times the item was started
+    unsigned epoch;                 // Host limit epoch at start, one decrease per epoch
+} sched_item_t;
+
+/**
+ * @brief   Outcome of a request attempt as seen by host health tracking
+ */
+typedef enum sched_result
+{
+    SCHED_SUCCESS,                  // Host replied with anything but 5xx
+    SCHED_FAILURE,                  // Connect failure, timeout or 5xx reply
+    SCHED_ABORTED,                  // Attempt ended for reasons unrelated to host health
+} sched_result_t;
+
+/**
+ * @brief       Init options with defaults.
+ */
+void sched_options_init(sched_options_t* opts);
+
+/**
+ * @brief       Parse per host options specification: comma separated list of
+ *              maxconn=<n>, retries=<n>, backoff=<ms>, maxbackoff=<ms>, breaker=<failures>, cooldown=<ms>
+ *
+ * @returns     0 on success, EINVAL if specification contains unknown option or invalid value
+ */
+int sched_options_parse(sched_options_t* opts, const char* spec);
+
+/**
+ * @brief       Create scheduler.
+ *
+ * @returns     0 on success, ENOMEM if there was no memory.
+ */
+int sched_init(const sched_options_t* opts, sched_t** out_sched);
+
+/**
+ * @brief       Free scheduler and its host table. Queued items are not owned by scheduler.
+ */
+void sched_free(sched_t* sched);
+
+/**
+ * @brief       Queue new item for host identified by @hostkey@ (host:port).
+ *
+ * @returns     0 on success, ENOMEM if there was no memory.
+ */
+int sched_add(sched_t* sched, sched_item_t* item, const char* hostkey);
+
+/**
+ * @brief       Put item that is due for a retry back at the head of its host queue.
+ */
+void sched_requeue(sched_t* sched, sched_item_t* item);
+
+/**
+ * @brief       Take next item that can be started now, hosts are served round-robin.
+ *
+ * @out_error   0 if item should be started
+ *              EHOSTDOWN if item host circuit breaker is open and item has to fail right away
+ *
+ * @returns     Item or NULL if every host with queued items is at its concurrency limit.
+ */
+sched_item_t* sched_next(sched_t* sched, uint64_t now, int* out_error);
+
+/**
+ * @brief       Report finished attempt of a started item.
+ *
+ * @latency     Time to first byte in milliseconds, only meaningful for SCHED_SUCCESS
+ */
+void sched_done(sched_t* sched, sched_item_t* item, sched_result_t result, uint64_t latency, uint64_t now);
+
+/**
+ * @brief       Report finished attempt of a started item and queue it for another host identified by @hostkey@,
+ *              for requests that go on to a different host, like redirects. Item waits for a turn at new host
+ *              as if it was just added there, its retries are counted from scratch.
+ *
+ * @returns     0 on success, ENOMEM if there was no memory, item is still started on its old host then.
+ */
+int sched_move(sched_t* sched, sched_item_t* item, const char* hostkey, sched_result_t result, uint64_t latency, uint64_t now);
+
+/**
+ * @brief       Key of the host item is queued or started for.
+ */
+const char* sched_item_host(const sched_item_t* item);
+
+/**
+ * @brief       Jittered exponential backoff before next attempt of this item in milliseconds.
+ */
+uint64_t sched_backoff(sched_t* sched, const sched_item_t* item);
+
+/**
+ * @brief       Check if there are queued items.
+ */
+bool sched_empty(const sched_t* sched);
+
+/**
+ * @brief       Print per host summary to stderr.
+ */
+void sched_print_stats(const sched_t* sched);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -7,7 +7,11 @@
 #define _POSIX_SOURCE
 #define _GNU_SOURCE
 
+#include "netopt.h"
+#include "fetch.h"
+#include "archive.h"
 #include "url.h"
+#include "urlset.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -16,239 +20,154 @@
 #include <signal.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <unistd.h>
-#include <netdb.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-
-#include <pcre.h>
 
 /*************************************************************************************************/
 
-static int parse_url(const char* urlstr, url_t* url)
+/*
+ * Canonical spelling of URL, equivalent URLs are fetched once and archived under the same name.
+ * URL that does not parse is returned as is, fetcher reports it. NULL if there was no memory.
+ */
+static char* canonical_url(url_parser_t* parser, const char* urlstr)
 {
-    int error = 0;
-
-    url_parser_t* parser;
-    error = url_parser_init_default(&parser);
-    if (error) {
-        fprintf(stderr, "Could not initilize url parser: %s\n", strerror(error));
-        return error;
-    }
-
-    error = url_parse(parser, urlstr, url);
-    url_parser_free(parser);
+    char* canonical = NULL;
 
-    if (error) {
-        fprintf(stderr, "Could not parse URL \'%s\': %s\n", urlstr, strerror(error));
-        return error;
+    url_t url;
+    if (0 == url_parse(parser, urlstr, &url)) {
+        url_normalize(&url, &canonical);
+        url_free(&url);
     }
 
-    return 0;
+    return (canonical ? canonical : strdup(urlstr));
 }
 
 /*
- * Connect to specified host
+ * Queue every URL listed in listfile, one per line, skipping those equivalent to an earlier one.
+ * Contents of URL on N-th line are stored as outdir/N or written to stdout if there is no outdir.
  */
-static int connect_socket(const char* host, const char* port, int* out_sockfd)
+static int add_url_list(fetcher_t* fetcher, url_parser_t* parser, const char* liststr, const char* outdir,
+                        size_t* out_nurls, size_t* out_nduplicates)
 {
     int error = 0;
 
-    struct addrinfo hints;
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = 0;
-    hints.ai_flags = 0;
-
-    struct addrinfo* res = NULL;
-    error = getaddrinfo(host, port, &hints, &res);
+    url_set_t* seen = NULL;
+    error = url_set_init(0, &seen);
     if (error) {
-        fprintf(stderr, "getaddrinfo('%s') failed with %s\n", host, gai_strerror(error));
         return error;
     }
 
-    int fd = -1;
-    struct addrinfo* hostinfo = res;
-    while (hostinfo != NULL) 
-    {
-        // Look for AF_INET and AF_INET6 family
-        if (hostinfo->ai_family == AF_INET || hostinfo->ai_family == AF_INET6) {
-            break;
-        }
-
-        hostinfo = hostinfo->ai_next;
-    }
-
-    if (!hostinfo) {
-        fprintf(stderr, "Could not find suitable addrinfo to connect\n");
-        error = ENOENT;
-        goto error_out;
-    }
-    
-    fd = socket(hostinfo->ai_family, hostinfo->ai_socktype, hostinfo->ai_protocol);
-    if (fd < 0) {
+    FILE* listfile = (0 == strcmp(liststr, "-") ? stdin : fopen(liststr, "r"));
+    if (!listfile) {
         error = errno;
-        perror("Failed to create socket");
-        goto error_out;
-    }
-
-    error = connect(fd, hostinfo->ai_addr, hostinfo->ai_addrlen);
-    if (error) {
-        fprintf(stderr, "Failed to connect: %s\n", strerror(error));
-        goto error_out;
+        perror("Could not open URL list file");
+        url_set_free(seen);
+        return error;
     }
 
-    *out_sockfd = fd;
-    
-error_out:
-    freeaddrinfo(res);
-    if (error && (fd >= 0)) {
-        close(fd);  
-    } 
-
-    return error;
-}
+    size_t nlines = 0;
+    size_t nurls = 0;
+    size_t nduplicates = 0;
 
-/*
- * Prepare and send HTTP get request accroding to URL contents
- */
-static int send_http_get(const url_t* url, int sockfd)
-{
-    int res = 0;
-
-    // Build HTTP get query
-    const char* format = "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n";
-    const char* path = (url->fullpath ? url->fullpath : "/");
-
-    size_t query_length = snprintf(NULL, 0, format, path, url->host);
-    size_t bufsize = query_length + 1;
+    char* line = NULL;
+    size_t linesize = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linesize, listfile)) != -1)
+    {
+        // Strip line terminator and skip empty lines
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+            line[--linelen] = '\0';
+        }
 
-    char* query = calloc(1, bufsize);
-    if (!query) {
-        fprintf(stderr, "No memory to allocate query buffer size %zd\n", bufsize);
-        return ENOMEM;
-    }
+        if (linelen == 0) {
+            continue;
+        }
 
-    snprintf(query, bufsize, format, path, url->host);
+        ++nlines;
 
-    // Send the query
-    int sent = 0;
-    while (sent < query_length) {
-        res = send(sockfd, query + sent, query_length - sent, 0);
-        if (res == -1) {
-            perror("send failed\n");
-            free(query);
-            return -1;
+        char* urlstr = canonical_url(parser, line);
+        if (!urlstr) {
+            error = ENOMEM;
+            break;
         }
 
-        sent += res;
-    }
+        // Duplicates are dropped before any network work
+        error = url_set_add(seen, urlstr);
+        if (error == EEXIST) {
+            ++nduplicates;
+            free(urlstr);
+            error = 0;
+            continue;
+        } else if (error) {
+            free(urlstr);
+            break;
+        }
 
-    free(query);
-    return 0;
-}
+        ++nurls;
 
-/*
- * A slow way to recieve a line from HTTP reply
- * Called initially to parse reply header
-  */
-static int recv_line(int sockfd, char* buf, size_t maxchars)
-{
-    size_t nbytes = 0;
-    char prev = '\0';
-    while (maxchars-- > 0)
-    {
-        int res = recv(sockfd, buf, 1, 0);
-        if (res == -1) {
-            perror("recv failed");
-            return res;
-        } 
-        else if (res == 0) {
-            break;
+        char outpath[PATH_MAX];
+        if (outdir) {
+            snprintf(outpath, sizeof(outpath), "%s/%zu", outdir, nlines);
         }
 
-        // Look for \r\n
-        if (prev == '\r' && *buf == '\n') {
+        error = fetcher_add(fetcher, urlstr, (outdir ? outpath : NULL));
+        free(urlstr);
+        if (error) {
             break;
         }
+    }
 
-        prev = *buf++;
-        ++nbytes;
+    free(line);
+    if (listfile != stdin) {
+        fclose(listfile);
     }
 
-    return nbytes;    
+    url_set_free(seen);
+
+    *out_nurls = nurls;
+    *out_nduplicates = nduplicates;
+    return error;
 }
 
 /*
- * Parse HTTP reply header, extract status and skip until the start of data
+ * Copy stored body of URL from archive to outpath or stdout
  */
-static int parse_http_reply(int sockfd)
+static int extract_url(const char* archivestr, const char* urlstr, const char* outpath)
 {
-    int res = 0;
-
-    // Recv reply header line
-    char linebuf[1024] = {0};
-    res = recv_line(sockfd, linebuf, sizeof(linebuf) - 1);
-    if (res == -1) {
-        fprintf(stderr, "Failed to recieve HTTP reply\n");
-        return res;
-    }
-
-    fprintf(stderr, "%s\n", linebuf);
-
-    const char* reply_regex = "^HTTP/1.[01] ([\\d]+) ([\\w]+)";
-    const char* error_str = NULL;
-    int error_offset = 0;
-
-    pcre* re = pcre_compile(reply_regex, 0, &error_str, &error_offset, NULL);
-    if (!re) {
-        fprintf(stderr, "Failed to compile regex: %s\n", error_str);
-        return -1;
-    }
-
-    int matchvec[9] = {0};
-    int nmatches = pcre_exec(re, NULL, linebuf, strlen(linebuf), 0, 0, matchvec, sizeof(matchvec) / sizeof(*matchvec));
-
-    pcre_free(re); // Don't need it anymore
+    int error = 0;
 
-    if (nmatches < 0) {
-        fprintf(stderr, "HTTP reply header match failed: %d\n", nmatches);
-        return -1;
+    archive_reader_t* reader = NULL;
+    error = archive_reader_open(archivestr, &reader);
+    if (error) {
+        return error;
     }
 
-    const char* status_code_str = NULL;
-    res = pcre_get_substring(linebuf, matchvec, nmatches, 1, &status_code_str);
-    if (res < 0) {
-        fprintf(stderr, "Status code string failed to match\n");
-        return res;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    error = archive_reader_find(reader, urlstr, &offset, &length);
+    if (error) {
+        fprintf(stderr, "%s: not found in archive '%s'\n", urlstr, archivestr);
+        goto out;
     }
 
-    // Check OK status
-    long status_code = atol(status_code_str);
-    pcre_free_substring(status_code_str);
-
-    fprintf(stderr, "HTTP reply status code %ld\n", status_code);
-
-    if (status_code != 200) {
-        fprintf(stderr, "HTTP request failed\n");
-        return -1;
+    FILE* outfile = (outpath ? fopen(outpath, "w+") : stdout);
+    if (!outfile) {
+        error = errno;
+        fprintf(stderr, "Could not open output file '%s': %s\n", outpath, strerror(error));
+        goto out;
     }
 
-    // Skip until start of data
-    while (1) {
-        res = recv_line(sockfd, linebuf, sizeof(linebuf) - 1);
-        if (res == -1) {
-            fprintf(stderr, "Failed to recieve HTTP reply\n");
-            return res;
-        }
+    error = archive_reader_copy(reader, offset, length, outfile);
 
-        if (0 == strncmp(linebuf, "\r\n", res)) {
-            break;
-        }
+    if (outfile != stdout) {
+        fclose(outfile);
     }
 
-    return 0;    
+out:
+    archive_reader_close(reader);
+    return error;
 }
 
 /*************************************************************************************************/
@@ -256,10 +175,51 @@ static int parse_http_reply(int sockfd)
 static void usage()
 {
     printf("httpget -u URL [-o path] [-h]\n");
+    printf("httpget -i FILE [-o dir] [-j N] [-h]\n");
+    printf("httpget -i FILE -a ARCHIVE [-j N] [-h]\n");
+    printf("httpget -r URL -a ARCHIVE [-o path] [-h]\n");
     printf("simple HTTP client to download URL contents\n");
     printf("  -h   This help\n");
-    printf("  -u   HTTP urls are accepted as targets. Proxy is not supported.\n");
+    printf("  -u   HTTP and HTTPS urls are accepted as targets. Proxy is not supported.\n");
+    printf("  -i   File with URLs to download, one per line, '-' for stdin. URLs are normalized and those equivalent\n");
+    printf("       to an earlier one are skipped: case of scheme and host, default port, dot segments,\n");
+    printf("       percent-encoding and fragments do not make a URL different.\n");
     printf("  -o   Optional file name to store URL contents in. Will use stdout if not specified.\n");
+    printf("       With -i this is a directory where contents of URL on N-th line are stored as file N.\n");
+    printf("  -a   Append successful replies with their headers to a single WARC style archive instead of\n");
+    printf("       separate files. Sorted index of stored bodies is written next to it as ARCHIVE.idx.\n");
+    printf("  -r   Read stored body of URL from archive given with -a.\n");
+    printf("  -j   Maximum number of concurrent transfers, 1 by default. Always 1 when writing to stdout.\n");
+    printf("  -l   Maximum number of redirects to follow, 5 by default, 0 treats redirect as failure.\n");
+    printf("       Permanent redirects are remembered and followed without a request for the rest of the run.\n");
+    printf("  -T   Deadlines, comma separated list of:\n");
+    printf("         connect=<ms>, firstbyte=<ms> after connect, idle=<ms> between reads, total=<ms>,\n");
+    printf("         minrate=<bytes/s> averaged over rateperiod=<ms>, 10000 by default.\n");
+    printf("  -H   Per host scheduling, comma separated list of:\n");
+    printf("         maxconn=<n> upper bound of adaptive per host concurrency, 16 by default,\n");
+    printf("         retries=<n> for connect failures and 5xx replies, 0 by default,\n");
+    printf("         backoff=<ms> first retry delay, doubled on every retry, 100 by default, maxbackoff=<ms>,\n");
+    printf("         breaker=<n> consecutive failures that make host fail fast, disabled by default,\n");
+    printf("         cooldown=<ms> before host that failed fast is probed again, 5000 by default.\n");
+    printf("  -s   TLS options for HTTPS, comma separated list of:\n");
+    printf("         insecure - do not verify server certificate, cafile=<path> with trusted certificates,\n");
+    printf("         noresume - always do full handshake instead of resuming previous session with host,\n");
+    printf("         ktls - let kernel encrypt and decrypt records when it supports that.\n");
+    printf("  -P   Protocol for http URLs, comma separated list of:\n");
+    printf("         http1 - connection per URL, default, or h2c - HTTP/2 with prior knowledge, one connection per host\n");
+    printf("         with concurrent transfers (-j, -H maxconn) as streams on it,\n");
+    printf("         window=<bytes> per stream receive window, 1 MB by default,\n");
+    printf("         connwindow=<bytes> connection receive window, 16 MB by default.\n");
+    printf("  -M   Statistics in Prometheus text format, comma separated list of:\n");
+    printf("         file=<path> rewritten atomically on every interval, for node_exporter textfile collector,\n");
+    printf("         socket=<path> of Unix stream socket every interval is sent to,\n");
+    printf("         interval=<ms> between writes, 10000 by default. Final numbers are written at exit.\n");
+    printf("  -b   Comma separated list of local source addresses to bind outgoing connections to, round-robin.\n");
+    printf("  -L   SO_LINGER timeout in seconds for outgoing sockets. 0 resets connections on close, skipping TIME_WAIT.\n");
+    printf("  -R   Set SO_REUSEADDR on outgoing sockets.\n");
+    printf("  -t   TCP tuning profile, comma separated list of:\n");
+    printf("         nodelay, quickack, rcvbuf=<bytes>, sndbuf=<bytes>, busypoll=<usec>,\n");
+    printf("         fastopen - send request in SYN when server has given us a fast open cookie before.\n");
 }
 
 int main(int argc, char** argv)
@@ -267,10 +227,24 @@ int main(int argc, char** argv)
     int error = 0;
 
     const char* urlstr = NULL;
+    const char* liststr = NULL;
     const char* outstr = NULL;
+    const char* archivestr = NULL;
+    const char* readstr = NULL;
+    archive_t* archive = NULL;
+    url_parser_t* url_parser = NULL;
+    char* canonical = NULL;
+
+    net_options_t netopts;
+    net_options_init(&netopts);
+
+    fetch_options_t fetchopts;
+    fetch_options_init(&fetchopts, &netopts);
+
+    fetcher_t* fetcher = NULL;
 
     int c;
-    while((c = getopt(argc, argv, "hu:o:")) != -1)
+    while((c = getopt(argc, argv, "hu:i:o:a:r:j:l:T:H:s:P:M:b:L:Rt:")) != -1)
     {
         switch(c)
         {
@@ -278,10 +252,80 @@ int main(int argc, char** argv)
             urlstr = optarg;
             break;
 
+        case 'i':
+            liststr = optarg;
+            break;
+
         case 'o':
             outstr = optarg;
             break;
 
+        case 'a':
+            archivestr = optarg;
+            break;
+
+        case 'r':
+            readstr = optarg;
+            break;
+
+        case 'j':
+            fetchopts.max_inflight = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'l':
+            fetchopts.max_redirects = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'T':
+            if (fetch_options_parse_timeouts(&fetchopts, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'H':
+            if (sched_options_parse(&fetchopts.sched, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 's':
+            if (tls_options_parse(&fetchopts.tls, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'P':
+            if (h2_options_parse(&fetchopts.h2, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'M':
+            if (stats_options_parse(&fetchopts.stats, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'b':
+            if (net_options_add_srcaddrs(&netopts, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'L':
+            netopts.linger = atoi(optarg);
+            break;
+
+        case 'R':
+            netopts.reuseaddr = true;
+            break;
+
+        case 't':
+            if (net_options_parse_tuning(&netopts, optarg)) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
         case 'h': 
             usage();
             exit(EXIT_SUCCESS);
@@ -292,94 +336,90 @@ int main(int argc, char** argv)
         }
     }
 
-    if (!urlstr) {
-        fprintf(stderr, "Please provide URL string\n");
-        usage();
+    // URLs are used in canonical form, so that equivalent spellings share fetches and archive records
+    error = url_parser_init_default(&url_parser);
+    if (error) {
+        fprintf(stderr, "Could not initilize url parser\n");
         exit(EXIT_FAILURE);
     }
 
-    url_t url;
-    int sockfd = -1;
-    FILE* outfile = stdout;
-
-    error = parse_url(urlstr, &url);
-    if (error) {
-        fprintf(stderr, "Could not parse URL \'%s\'\n", urlstr);
-        goto out;
-    }
+    if (readstr) {
+        if (!archivestr) {
+            fprintf(stderr, "Please provide archive to read from\n");
+            usage();
+            exit(EXIT_FAILURE);
+        }
 
-    // Check for supported scheme (default scheme is http)
-    const char* scheme = (url.scheme ? url.scheme : "http");
-    if (0 != strcmp(scheme, "http")) {
-        printf("Scheme '%s' is not supported\n", scheme);
-        error = ENOTSUP;
-        goto out;
-    }        
+        canonical = canonical_url(url_parser, readstr);
+        error = (canonical ? extract_url(archivestr, canonical, outstr) : ENOMEM);
 
-    // Authentication is not supported
-    if (url.username || url.password) {
-        printf("Authentication is not supported\n");
-        error = ENOTSUP;
-        goto out;
+        free(canonical);
+        url_parser_free(url_parser);
+        fetch_options_free(&fetchopts);
+        net_options_free(&netopts);
+        return error;
     }
 
-    // Open output file if needed
-    if (outstr) {
-        outfile = fopen(outstr, "w+");
+    if (!urlstr && !liststr) {
+        fprintf(stderr, "Please provide URL string\n");
+        usage();
+        exit(EXIT_FAILURE);
     }
 
-    if (!outfile) {
-        perror("Could not open output file");
-        goto out;
+    if (archivestr) {
+        error = archive_open(archivestr, &archive);
+        if (error) {
+            goto out;
+        }
+
+        fetchopts.archive = archive;
+    } else if (!outstr) {
+        // Concurrent replies would interleave on stdout
+        fetchopts.max_inflight = 1;
     }
 
-    // Connect to host
-    error = connect_socket(url.host, (url.port ? url.port : "80"), &sockfd);
+    error = fetcher_init(&fetchopts, &fetcher);
     if (error) {
         goto out;
     }
 
-    printf("Connected to %s\n", url.host);
-
-    // Construct and send HTTP GET request
-    error = send_http_get(&url, sockfd);
-    if (error) {
-        goto out;
+    size_t nurls = 1;
+    size_t nduplicates = 0;
+    if (liststr) {
+        error = add_url_list(fetcher, url_parser, liststr, outstr, &nurls, &nduplicates);
+    } else {
+        canonical = canonical_url(url_parser, urlstr);
+        error = (canonical ? fetcher_add(fetcher, canonical, outstr) : ENOMEM);
     }
 
-    // Patse HTTP GET reply, check status and advance to start of data
-    error = parse_http_reply(sockfd);
     if (error) {
         goto out;
     }
 
-    // read remaining data in chunks
-    char buf[1024] = {0};
-    while(1) 
-    {
-        memset(buf, 0, sizeof(buf));
-        int nbytes = recv(sockfd, buf, sizeof(buf) - 1, 0);
-        if (nbytes == -1) {
-            perror("recv failed");
-            goto out;
-        } 
-        else if (nbytes == 0) {
-            break;
-        }
+    size_t nfailed = 0;
+    error = fetcher_run(fetcher, &nfailed);
 
-        fprintf(outfile, "%s", buf);    
+    if (liststr) {
+        fprintf(stderr, "Fetched %zu of %zu URLs\n", nurls - nfailed, nurls);
+        if (nduplicates) {
+            fprintf(stderr, "Saved %zu fetches of duplicate URLs\n", nduplicates);
+        }
     }
 
 out:
-    // Cleanup and return
-    if (sockfd >= 0) {
-        close(sockfd);
-    }
-
-    if (outfile != stdout) {
-        fclose(outfile);
+    fetcher_free(fetcher);
+    url_parser_free(url_parser);
+    free(canonical);
+
+    if (archive) {
+        int close_error = archive_close(archive);
+        if (!error) {
+            error = close_error;
+        }
     }
 
-    url_free(&url);
+    net_options_print_stats(&netopts);
+    fetch_options_free(&fetchopts);
+    net_options_free(&netopts);
     return error;
 }
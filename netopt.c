@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+
+#include "netopt.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*************************************************************************************/
+
+#if !defined(IP_BIND_ADDRESS_NO_PORT)
+#   define IP_BIND_ADDRESS_NO_PORT  24
+#endif
+
+#if !defined(TCP_FASTOPEN_CONNECT)
+#   define TCP_FASTOPEN_CONNECT     30
+#endif
+
+#if !defined(SO_BUSY_POLL)
+#   define SO_BUSY_POLL             46
+#endif
+
+/*************************************************************************************/
+
+void net_options_init(net_options_t* opts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->linger = -1;
+
+    // Separate processes started with the same source address list should not all start from the first address
+    opts->next_srcaddr = (size_t)getpid();
+}
+
+void net_options_free(net_options_t* opts)
+{
+    if (opts)
+    {
+        free(opts->srcaddrs);
+        memset(opts, 0, sizeof(*opts));
+    }
+}
+
+/*
+ * Resolve single numeric address string into sockaddr
+ */
+static int parse_srcaddr(const char* addrstr, struct sockaddr_storage* out_addr)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_PASSIVE;
+
+    struct addrinfo* res = NULL;
+    int error = getaddrinfo(addrstr, "0", &hints, &res);
+    if (error) {
+        fprintf(stderr, "Invalid source address '%s': %s\n", addrstr, gai_strerror(error));
+        return EINVAL;
+    }
+
+    memset(out_addr, 0, sizeof(*out_addr));
+    memcpy(out_addr, res->ai_addr, res->ai_addrlen);
+
+    freeaddrinfo(res);
+    return 0;
+}
+
+int net_options_add_srcaddrs(net_options_t* opts, const char* addrlist)
+{
+    int error = 0;
+
+    if (!opts || !addrlist) {
+        return EINVAL;
+    }
+
+    char* list = strdup(addrlist);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* addrstr = strtok_r(list, ",", &saveptr); addrstr != NULL; addrstr = strtok_r(NULL, ",", &saveptr))
+    {
+        struct sockaddr_storage* addrs = realloc(opts->srcaddrs, (opts->nsrcaddrs + 1) * sizeof(*addrs));
+        if (!addrs) {
+            error = ENOMEM;
+            break;
+        }
+
+        opts->srcaddrs = addrs;
+
+        error = parse_srcaddr(addrstr, &opts->srcaddrs[opts->nsrcaddrs]);
+        if (error) {
+            break;
+        }
+
+        ++opts->nsrcaddrs;
+    }
+
+    free(list);
+    return error;
+}
+
+/*
+ * Parse non-negative integer tuning option value
+ */
+static int parse_tuning_value(const char* name, const char* valstr, int* out_value)
+{
+    char* end = NULL;
+    long value = (valstr ? strtol(valstr, &end, 10) : -1);
+    if (!valstr || *end != '\0' || value < 0 || value > INT_MAX) {
+        fprintf(stderr, "Invalid value for tuning option '%s'\n", name);
+        return EINVAL;
+    }
+
+    *out_value = (int)value;
+    return 0;
+}
+
+int net_options_parse_tuning(net_options_t* opts, const char* profile)
+{
+    int error = 0;
+
+    if (!opts || !profile) {
+        return EINVAL;
+    }
+
+    char* list = strdup(profile);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        if (0 == strcmp(name, "nodelay")) {
+            opts->nodelay = true;
+        } else if (0 == strcmp(name, "quickack")) {
+            opts->quickack = true;
+        } else if (0 == strcmp(name, "fastopen")) {
+            opts->fastopen = true;
+        } else if (0 == strcmp(name, "rcvbuf")) {
+            error = parse_tuning_value(name, valstr, &opts->rcvbuf);
+        } else if (0 == strcmp(name, "sndbuf")) {
+            error = parse_tuning_value(name, valstr, &opts->sndbuf);
+        } else if (0 == strcmp(name, "busypoll")) {
+            error = parse_tuning_value(name, valstr, &opts->busy_poll);
+        } else {
+            fprintf(stderr, "Unknown tuning option '%s'\n", name);
+            error = EINVAL;
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+/*
+ * setsockopt for an int option value
+ */
+static int set_int_option(int sockfd, int level, int name, int value, const char* namestr)
+{
+    if (setsockopt(sockfd, level, name, &value, sizeof(value))) {
+        int error = errno;
+        fprintf(stderr, "setsockopt(%s) failed: %s\n", namestr, strerror(error));
+        return error;
+    }
+
+    return 0;
+}
+
+/*
+ * Apply TCP tuning options
+ */
+static int apply_tuning(net_options_t* opts, int sockfd)
+{
+    int error = 0;
+
+    #define set_int_option_or_die(_level_, _name_, _value_)                         \
+        error = set_int_option(sockfd, (_level_), (_name_), (_value_), #_name_);    \
+        if (error) {                                                                \
+            return error;                                                           \
+        }                                                                           \
+
+    if (opts->nodelay) {
+        set_int_option_or_die(IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+
+    if (opts->quickack) {
+        set_int_option_or_die(IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+
+    // Buffer sizes have to be set before connect to affect window scale negotiated in SYN
+    if (opts->rcvbuf) {
+        set_int_option_or_die(SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+    }
+
+    if (opts->sndbuf) {
+        set_int_option_or_die(SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+    }
+
+    if (opts->busy_poll) {
+        set_int_option_or_die(SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll);
+    }
+
+    #undef set_int_option_or_die
+
+    // With TCP_FASTOPEN_CONNECT connect() returns right away and first send() carries data in SYN.
+    // Kernels before 4.11 do not know this option, fall back to regular handshake for good.
+    if (opts->fastopen) {
+        int on = 1;
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on))) {
+            fprintf(stderr, "TCP fast open is not available: %s\n", strerror(errno));
+            opts->fastopen = false;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Pick next pool address of given family in round-robin order, NULL if there is none
+ */
+static const struct sockaddr_storage* next_srcaddr(net_options_t* opts, int family)
+{
+    for (size_t i = 0; i < opts->nsrcaddrs; ++i)
+    {
+        const struct sockaddr_storage* addr = &opts->srcaddrs[opts->next_srcaddr++ % opts->nsrcaddrs];
+        if (addr->ss_family == family) {
+            return addr;
+        }
+    }
+
+    return NULL;
+}
+
+int net_options_apply(net_options_t* opts, int sockfd, int family)
+{
+    assert(opts != NULL);
+
+    if (opts->reuseaddr) {
+        int on = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))) {
+            perror("setsockopt(SO_REUSEADDR) failed");
+            return errno;
+        }
+    }
+
+    if (opts->linger >= 0) {
+        struct linger lg = { .l_onoff = 1, .l_linger = opts->linger };
+        if (setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg))) {
+            perror("setsockopt(SO_LINGER) failed");
+            return errno;
+        }
+    }
+
+    int error = apply_tuning(opts, sockfd);
+    if (error) {
+        return error;
+    }
+
+    const struct sockaddr_storage* srcaddr = next_srcaddr(opts, family);
+    if (!srcaddr) {
+        return 0;
+    }
+
+    // Not fatal, we will just get a port reserved at bind time
+    int on = 1;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on))) {
+        perror("setsockopt(IP_BIND_ADDRESS_NO_PORT) failed");
+    }
+
+    socklen_t addrlen = (family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    if (bind(sockfd, (const struct sockaddr*)srcaddr, addrlen)) {
+        error = errno;
+        perror("Failed to bind source address");
+        return error;
+    }
+
+    return 0;
+}
+
+void net_options_rearm(const net_options_t* opts, int sockfd)
+{
+    assert(opts != NULL);
+
+    if (opts->quickack) {
+        int on = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+}
+
+bool net_options_count_failure(net_options_t* opts, int error)
+{
+    assert(opts != NULL);
+
+    switch(error) {
+    case EADDRINUSE     : ++opts->addrinuse_failures; return true;
+    case EADDRNOTAVAIL  : ++opts->addrnotavail_failures; return true;
+    default             : return false;
+    }
+}
+
+void net_options_print_stats(const net_options_t* opts)
+{
+    assert(opts != NULL);
+
+    if (opts->addrinuse_failures || opts->addrnotavail_failures) {
+        fprintf(stderr, "Address failures: %lu EADDRINUSE, %lu EADDRNOTAVAIL\n",
+                opts->addrinuse_failures, opts->addrnotavail_failures);
+    }
+}
+
+/*************************************************************************************/
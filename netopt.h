@@ -0,0 +1,104 @@
+/**
+ * @file netopt.h
+ *
+ * Outgoing socket options: source address pool, close behaviour and TCP tuning
+ */
+
+#ifndef _HTTPGET_NETOPT_H_
+#define _HTTPGET_NETOPT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Options applied to every outgoing socket and counters of address related failures
+ */
+typedef struct net_options
+{
+    struct sockaddr_storage* srcaddrs;  // Local source addresses to bind to, round-robin
+    size_t nsrcaddrs;
+    size_t next_srcaddr;
+
+    int linger;                         // SO_LINGER timeout in seconds, -1 to keep system default
+    bool reuseaddr;                     // Set SO_REUSEADDR on outgoing sockets
+
+    bool nodelay;                       // TCP_NODELAY
+    bool quickack;                      // TCP_QUICKACK, has to be rearmed after every read
+    bool fastopen;                      // TCP_FASTOPEN_CONNECT, request goes out with SYN
+    int rcvbuf;                         // SO_RCVBUF in bytes, 0 to keep system autotuning
+    int sndbuf;                         // SO_SNDBUF in bytes, 0 to keep system autotuning
+    int busy_poll;                      // SO_BUSY_POLL in microseconds, 0 to disable
+
+    unsigned long addrinuse_failures;   // EADDRINUSE seen on bind or connect
+    unsigned long addrnotavail_failures;// EADDRNOTAVAIL seen on bind or connect
+} net_options_t;
+
+/**
+ * @brief       Init options to system defaults: no source address binding, default linger and reuse.
+ */
+void net_options_init(net_options_t* opts);
+
+/**
+ * @brief       Free all resources associated with these options.
+ */
+void net_options_free(net_options_t* opts);
+
+/**
+ * @brief       Add comma separated list of numeric IPv4 or IPv6 addresses to source address pool.
+ *
+ * @returns     0 on success
+ *              EINVAL if list contains something that is not a numeric address
+ *              ENOMEM if there was no memory
+ */
+int net_options_add_srcaddrs(net_options_t* opts, const char* addrlist);
+
+/**
+ * @brief       Parse TCP tuning profile: comma separated list of
+ *              nodelay, quickack, fastopen, rcvbuf=<bytes>, sndbuf=<bytes>, busypoll=<usec>
+ *
+ * @returns     0 on success
+ *              EINVAL if profile contains unknown option or invalid value
+ *              ENOMEM if there was no memory
+ */
+int net_options_parse_tuning(net_options_t* opts, const char* profile);
+
+/**
+ * @brief       Prepare a freshly created socket for connect: apply linger, reuse and tuning options
+ *              and bind it to the next pool source address of matching @family@ if there is one.
+ *
+ *              Binding uses IP_BIND_ADDRESS_NO_PORT so ephemeral port is chosen at connect time
+ *              by the 4-tuple, not by bind, which lets each source address use the whole port range
+ *              towards every destination.
+ *
+ * @returns     0 on success, errno value if any of the socket calls failed.
+ */
+int net_options_apply(net_options_t* opts, int sockfd, int family);
+
+/**
+ * @brief       Rearm TCP_QUICKACK if requested, kernel clears it as soon as it falls back to delayed acks.
+ *              Should be called after every read from socket.
+ */
+void net_options_rearm(const net_options_t* opts, int sockfd);
+
+/**
+ * @brief       Account for a failed bind or connect.
+ *
+ * @returns     true if @error@ is an address exhaustion error and it makes sense
+ *              to retry with a new socket and next source address.
+ */
+bool net_options_count_failure(net_options_t* opts, int error);
+
+/**
+ * @brief       Print address failure counters to stderr if there were any.
+ */
+void net_options_print_stats(const net_options_t* opts);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
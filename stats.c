@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*************************************************************************************/
+
+#if !defined(countof)
+#   define countof(_arr_)   (sizeof((_arr_)) / sizeof(*(_arr_)))
+#endif
+
+static const char* g_error_class_names[STATS_ERROR_COUNT] = {
+    [STATS_ERROR_CONNECT] = "connect",
+    [STATS_ERROR_TIMEOUT] = "timeout",
+    [STATS_ERROR_RESET] = "reset",
+    [STATS_ERROR_PROTOCOL] = "protocol",
+    [STATS_ERROR_HTTP_4XX] = "http_4xx",
+    [STATS_ERROR_HTTP_5XX] = "http_5xx",
+    [STATS_ERROR_HTTP_OTHER] = "http_other",
+    [STATS_ERROR_HOST_DOWN] = "host_down",
+    [STATS_ERROR_OTHER] = "other",
+};
+
+static const double g_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/*************************************************************************************/
+
+/*
+ * Highest value that falls into bucket
+ */
+static uint64_t bucket_upper_bound(size_t index)
+{
+    if (index < HDR_SUB_BUCKETS) {
+        return index;
+    }
+
+    size_t offset = index - HDR_SUB_BUCKETS;
+    unsigned shift = offset / (HDR_SUB_BUCKETS / 2) + 1;
+    uint64_t sub_bucket = offset % (HDR_SUB_BUCKETS / 2) + HDR_SUB_BUCKETS / 2;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t hdr_quantile(const hdr_histogram_t* h, double quantile)
+{
+    assert(h != NULL);
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    // Rank of the value we are after, 1 based
+    uint64_t rank = (uint64_t)(quantile * h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HDR_BUCKETS; ++i) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_upper_bound(i);
+            return (value < h->max ? value : h->max);
+        }
+    }
+
+    return h->max;
+}
+
+/*************************************************************************************/
+
+void stats_options_init(stats_options_t* opts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->interval = 10000;
+}
+
+int stats_options_parse(stats_options_t* opts, const char* spec)
+{
+    int error = 0;
+
+    if (!opts || !spec) {
+        return EINVAL;
+    }
+
+    char* list = strdup(spec);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        if (!valstr || *valstr == '\0') {
+            fprintf(stderr, "Invalid value for statistics option '%s'\n", name);
+            error = EINVAL;
+            break;
+        }
+
+        char** path = NULL;
+        if (0 == strcmp(name, "file")) {
+            path = &opts->path;
+        } else if (0 == strcmp(name, "socket")) {
+            path = &opts->socket;
+        } else if (0 == strcmp(name, "interval")) {
+            char* end = NULL;
+            long value = strtol(valstr, &end, 10);
+            if (*end != '\0' || value <= 0 || value > INT_MAX) {
+                fprintf(stderr, "Invalid value for statistics option '%s'\n", name);
+                error = EINVAL;
+                break;
+            }
+            opts->interval = value;
+        } else {
+            fprintf(stderr, "Unknown statistics option '%s'\n", name);
+            error = EINVAL;
+        }
+
+        if (path) {
+            free(*path);
+            *path = strdup(valstr);
+            if (!*path) {
+                error = ENOMEM;
+            }
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+void stats_options_free(stats_options_t* opts)
+{
+    if (opts) {
+        free(opts->path);
+        free(opts->socket);
+        opts->path = opts->socket = NULL;
+    }
+}
+
+/*************************************************************************************/
+
+void stats_init(stats_t* stats, uint64_t now)
+{
+    assert(stats != NULL);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->last_write_time = now;
+}
+
+stats_error_t stats_classify(int error, long status_code)
+{
+    if (status_code >= 500 && status_code < 600) {
+        return STATS_ERROR_HTTP_5XX;
+    } else if (status_code >= 400 && status_code < 500) {
+        return STATS_ERROR_HTTP_4XX;
+    } else if (status_code && status_code != 200) {
+        return STATS_ERROR_HTTP_OTHER;
+    }
+
+    switch (error)
+    {
+    case ETIMEDOUT:
+        return STATS_ERROR_TIMEOUT;
+
+    case ECONNREFUSED:
+    case ENETUNREACH:
+    case EHOSTUNREACH:
+    case EADDRINUSE:
+    case EADDRNOTAVAIL:
+    case ENOENT:                    // No suitable address
+        return STATS_ERROR_CONNECT;
+
+    case ECONNRESET:
+    case EPIPE:
+        return STATS_ERROR_RESET;
+
+    case EPROTO:
+    case EMSGSIZE:
+        return STATS_ERROR_PROTOCOL;
+
+    case EHOSTDOWN:
+        return STATS_ERROR_HOST_DOWN;
+
+    default:
+        // getaddrinfo failures come as negative EAI_* codes
+        return (error < 0 ? STATS_ERROR_CONNECT : STATS_ERROR_OTHER);
+    }
+}
+
+static void format_summary(FILE* out, const char* name, const char* help, const hdr_histogram_t* h)
+{
+    fprintf(out, "# HELP %s %s\n", name, help);
+    fprintf(out, "# TYPE %s summary\n", name);
+
+    for (size_t i = 0; i < countof(g_quantiles); ++i) {
+        fprintf(out, "%s{quantile=\"%g\"} %.3f\n", name, g_quantiles[i], hdr_quantile(h, g_quantiles[i]) / 1000.0);
+    }
+
+    fprintf(out, "%s_sum %.3f\n", name, h->sum / 1000.0);
+    fprintf(out, "%s_count %llu\n", name, (unsigned long long)h->count);
+}
+
+static void format_metric(FILE* out, const char* name, const char* type, const char* help, double value)
+{
+    fprintf(out, "# HELP %s %s\n", name, help);
+    fprintf(out, "# TYPE %s %s\n", name, type);
+    fprintf(out, "%s %.15g\n", name, value);
+}
+
+/*
+ * Render all metrics in Prometheus text exposition format
+ */
+static void format_stats(FILE* out, stats_t* stats, uint64_t now, size_t inflight, size_t waiting)
+{
+    double elapsed = (now > stats->last_write_time ? (now - stats->last_write_time) / 1000.0 : 0.0);
+    double request_rate = (elapsed ? (stats->requests - stats->last_requests) / elapsed : 0.0);
+    double byte_rate = (elapsed ? (stats->bytes - stats->last_bytes) / elapsed : 0.0);
+
+    fprintf(out, "# HELP httpget_requests_total Completed transfers.\n");
+    fprintf(out, "# TYPE httpget_requests_total counter\n");
+    fprintf(out, "httpget_requests_total{result=\"success\"} %llu\n", (unsigned long long)(stats->requests - stats->failures));
+    fprintf(out, "httpget_requests_total{result=\"failure\"} %llu\n", (unsigned long long)stats->failures);
+
+    fprintf(out, "# HELP httpget_errors_total Failed transfers by error class.\n");
+    fprintf(out, "# TYPE httpget_errors_total counter\n");
+    for (size_t i = 0; i < STATS_ERROR_COUNT; ++i) {
+        fprintf(out, "httpget_errors_total{class=\"%s\"} %llu\n", g_error_class_names[i], (unsigned long long)stats->errors[i]);
+    }
+
+    format_metric(out, "httpget_retries_total", "counter", "Transfer attempts that were retried.", stats->retries);
+    format_metric(out, "httpget_redirects_total", "counter", "Redirect replies followed.", stats->redirects);
+    format_metric(out, "httpget_redirect_cache_hits_total", "counter", "Redirects followed from permanent redirect cache without a request.", stats->redirect_cache_hits);
+    format_metric(out, "httpget_received_bytes_total", "counter", "Reply body bytes received.", stats->bytes);
+    format_metric(out, "httpget_requests_per_second", "gauge", "Completed transfers per second since previous write.", request_rate);
+    format_metric(out, "httpget_received_bytes_per_second", "gauge", "Reply body bytes per second since previous write.", byte_rate);
+    format_metric(out, "httpget_inflight", "gauge", "Transfers in progress.", inflight);
+    format_metric(out, "httpget_waiting_retry", "gauge", "Transfers waiting for retry backoff to expire.", waiting);
+    format_metric(out, "httpget_connections_total", "counter", "Connections opened.", stats->connections);
+    format_metric(out, "httpget_reused_connection_requests_total", "counter", "Transfers sent over already open connection.", stats->reused);
+
+    fprintf(out, "# HELP httpget_tls_handshakes_total Completed TLS handshakes.\n");
+    fprintf(out, "# TYPE httpget_tls_handshakes_total counter\n");
+    fprintf(out, "httpget_tls_handshakes_total{type=\"full\"} %llu\n", (unsigned long long)stats->tls_full);
+    fprintf(out, "httpget_tls_handshakes_total{type=\"resumed\"} %llu\n", (unsigned long long)stats->tls_resumed);
+
+    format_summary(out, "httpget_ttfb_seconds", "Time from transfer start to first reply byte.", &stats->ttfb);
+    format_summary(out, "httpget_duration_seconds", "Time from transfer start to completion.", &stats->duration);
+}
+
+/*
+ * Replace file contents atomically, so that readers never see half written statistics
+ */
+static int write_file(const char* path, const char* data, size_t size)
+{
+    int error = 0;
+
+    char* tmppath = NULL;
+    if (asprintf(&tmppath, "%s.tmp", path) < 0) {
+        return ENOMEM;
+    }
+
+    FILE* file = fopen(tmppath, "w");
+    if (!file) {
+        error = errno;
+        free(tmppath);
+        return error;
+    }
+
+    if (fwrite(data, 1, size, file) != size) {
+        error = errno;
+    }
+
+    if (fclose(file) && !error) {
+        error = errno;
+    }
+
+    if (!error && rename(tmppath, path)) {
+        error = errno;
+    }
+
+    if (error) {
+        unlink(tmppath);
+    }
+
+    free(tmppath);
+    return error;
+}
+
+/*
+ * Push statistics to whoever listens on the socket. Never blocks, slow reader just misses an interval.
+ */
+static int write_socket(const char* path, const char* data, size_t size)
+{
+    int error = 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        error = errno;
+        goto out;
+    }
+
+    ssize_t res = send(fd, data, size, MSG_NOSIGNAL);
+    if (res < 0) {
+        error = errno;
+    } else if ((size_t)res != size) {
+        error = EAGAIN;
+    }
+
+out:
+    close(fd);
+    return error;
+}
+
+void stats_write(stats_t* stats, const stats_options_t* opts, uint64_t now, size_t inflight, size_t waiting)
+{
+    assert(stats != NULL);
+    assert(opts != NULL);
+
+    char* data = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&data, &size);
+    if (!out) {
+        return;
+    }
+
+    format_stats(out, stats, now, inflight, waiting);
+    fclose(out);
+
+    stats->last_write_time = now;
+    stats->last_requests = stats->requests;
+    stats->last_bytes = stats->bytes;
+
+    int error = 0;
+    if (opts->path) {
+        error = write_file(opts->path, data, size);
+        if (error && !stats->reported_failure) {
+            fprintf(stderr, "Could not write statistics to '%s': %s\n", opts->path, strerror(error));
+            stats->reported_failure = true;
+        }
+    }
+
+    if (opts->socket) {
+        error = write_socket(opts->socket, data, size);
+        if (error && !stats->reported_failure) {
+            fprintf(stderr, "Could not send statistics to '%s': %s\n", opts->socket, strerror(error));
+            stats->reported_failure = true;
+        }
+    }
+
+    free(data);
+}
+
+/*************************************************************************************/
@@ -0,0 +1,183 @@
+/**
+ * @file stats.h
+ *
+ * Transfer counters and latency histograms exported in Prometheus text format
+ */
+
+#ifndef _HTTPGET_STATS_H_
+#define _HTTPGET_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Log-linear histogram buckets in the manner of HdrHistogram: values below HDR_SUB_BUCKETS have
+ * a bucket each, above that every power of two range is split into HDR_SUB_BUCKETS / 2 buckets,
+ * which keeps relative error of any recorded value under 1 / (HDR_SUB_BUCKETS / 2).
+ */
+#define HDR_SUB_BUCKET_BITS     5
+#define HDR_SUB_BUCKETS         (1u << HDR_SUB_BUCKET_BITS)
+#define HDR_MAX_VALUE_BITS      40
+#define HDR_BUCKETS             (HDR_SUB_BUCKETS + (HDR_MAX_VALUE_BITS - HDR_SUB_BUCKET_BITS) * (HDR_SUB_BUCKETS / 2))
+
+/**
+ * @brief   Histogram of non-negative values, anything at or above 2^HDR_MAX_VALUE_BITS goes to the last bucket
+ */
+typedef struct hdr_histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t counts[HDR_BUCKETS];
+} hdr_histogram_t;
+
+/**
+ * @brief   Failed transfer classes
+ */
+typedef enum stats_error
+{
+    STATS_ERROR_CONNECT,            // Name resolution or connect failed
+    STATS_ERROR_TIMEOUT,            // Missed a deadline
+    STATS_ERROR_RESET,              // Connection or stream was reset
+    STATS_ERROR_PROTOCOL,           // Malformed reply, TLS or HTTP/2 failure
+    STATS_ERROR_HTTP_4XX,           // Client error reply
+    STATS_ERROR_HTTP_5XX,           // Server error reply
+    STATS_ERROR_HTTP_OTHER,         // Any other reply but 200
+    STATS_ERROR_HOST_DOWN,          // Failed fast on open circuit breaker
+    STATS_ERROR_OTHER,              // Local failures: output, memory
+    STATS_ERROR_COUNT
+} stats_error_t;
+
+/**
+ * @brief   Where and how often statistics are written
+ */
+typedef struct stats_options
+{
+    char* path;                     // File rewritten atomically on every interval, NULL to disable
+    char* socket;                   // Unix stream socket every interval is pushed to, NULL to disable
+    unsigned interval;              // Milliseconds between writes
+} stats_options_t;
+
+/**
+ * @brief   Counters and histograms. Engine is single threaded, counters are plain integers updated in place.
+ */
+typedef struct stats
+{
+    uint64_t requests;              // Completed transfers
+    uint64_t failures;              // Completed transfers that failed
+    uint64_t errors[STATS_ERROR_COUNT];
+    uint64_t retries;
+    uint64_t redirects;             // Redirect replies followed
+    uint64_t redirect_cache_hits;   // Redirect round trips saved by remembering permanent redirects
+    uint64_t bytes;                 // Reply body bytes received
+
+    uint64_t connections;           // Connections opened
+    uint64_t reused;                // Transfers that went over already open connection
+    uint64_t tls_full;              // TLS handshakes
+    uint64_t tls_resumed;
+
+    hdr_histogram_t ttfb;           // Time to first byte in milliseconds
+    hdr_histogram_t duration;       // Whole transfer time in milliseconds
+
+    uint64_t last_write_time;       // Rates are averaged between writes
+    uint64_t last_requests;
+    uint64_t last_bytes;
+    bool reported_failure;
+} stats_t;
+
+/**
+ * @brief       Bucket index of value.
+ */
+static inline size_t hdr_bucket(uint64_t value)
+{
+    if (value < HDR_SUB_BUCKETS) {
+        return value;
+    }
+
+    if (value >> HDR_MAX_VALUE_BITS) {
+        return HDR_BUCKETS - 1;
+    }
+
+    unsigned shift = (63 - __builtin_clzll(value)) - (HDR_SUB_BUCKET_BITS - 1);
+    return HDR_SUB_BUCKETS + (shift - 1) * (HDR_SUB_BUCKETS / 2) + ((value >> shift) - HDR_SUB_BUCKETS / 2);
+}
+
+/**
+ * @brief       Record value, this is meant for the hot path and costs a few instructions.
+ */
+static inline void hdr_record(hdr_histogram_t* h, uint64_t value)
+{
+    ++h->counts[hdr_bucket(value)];
+    ++h->count;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * @brief       Value at given quantile in [0, 1], highest value of the bucket quantile falls into
+ *              but never above highest recorded value. 0 if histogram is empty.
+ */
+uint64_t hdr_quantile(const hdr_histogram_t* h, double quantile);
+
+/**
+ * @brief       Init options: no output, 10 second interval.
+ */
+void stats_options_init(stats_options_t* opts);
+
+/**
+ * @brief       Parse statistics output specification: comma separated list of
+ *              file=<path>, socket=<path>, interval=<ms>
+ *
+ * @returns     0 on success
+ *              EINVAL if specification contains unknown option or invalid value
+ *              ENOMEM if there was no memory
+ */
+int stats_options_parse(stats_options_t* opts, const char* spec);
+
+/**
+ * @brief       Free all resources associated with these options.
+ */
+void stats_options_free(stats_options_t* opts);
+
+/**
+ * @brief       True if statistics have somewhere to go.
+ */
+static inline bool stats_enabled(const stats_options_t* opts)
+{
+    return opts->path || opts->socket;
+}
+
+/**
+ * @brief       Zero all counters, @now@ starts the first rate interval.
+ */
+void stats_init(stats_t* stats, uint64_t now);
+
+/**
+ * @brief       Classify failed transfer.
+ *
+ * @error       errno value transfer has failed with
+ * @status_code HTTP reply status code, 0 if there was no reply
+ */
+stats_error_t stats_classify(int error, long status_code);
+
+/**
+ * @brief       Write statistics in Prometheus text exposition format to every configured output.
+ *              Output failures are reported once and otherwise ignored.
+ *
+ * @now         Milliseconds, same clock as for @stats_init@
+ * @inflight    Transfers in progress
+ * @waiting     Transfers waiting for retry
+ */
+void stats_write(stats_t* stats, const stats_options_t* opts, uint64_t now, size_t inflight, size_t waiting);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
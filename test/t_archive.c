@@ -0,0 +1,235 @@
+/**
+ *  @brief  Archive writer and index lookup unit tests
+ */
+
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/*************************************************************************************/
+
+static char g_path[] = "/tmp/httpget_archive_XXXXXX";
+
+static const char* g_header = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n";
+
+/*
+ * Look up URL and read its body back through a temporary file
+ */
+static char* read_body(const archive_reader_t* reader, const char* url, size_t* out_length)
+{
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    if (archive_reader_find(reader, url, &offset, &length)) {
+        return NULL;
+    }
+
+    FILE* out = tmpfile();
+    if (!out) {
+        return NULL;
+    }
+
+    char* body = calloc(1, length + 1);
+    if (body && (archive_reader_copy(reader, offset, length, out) ||
+                 fseek(out, 0, SEEK_SET) ||
+                 fread(body, 1, length, out) != length)) {
+        free(body);
+        body = NULL;
+    }
+
+    fclose(out);
+    *out_length = length;
+    return body;
+}
+
+static void test_round_trip(void)
+{
+    archive_t* archive = NULL;
+    CU_ASSERT_EQUAL_FATAL(archive_open(g_path, &archive), 0);
+
+    char url[64];
+    char body[64];
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(url, sizeof(url), "http://example.com/%d", i);
+        snprintf(body, sizeof(body), "body of %d", i);
+        CU_ASSERT_EQUAL(archive_append(archive, url, g_header, strlen(g_header), body, strlen(body)), 0);
+    }
+
+    // Empty body and repeated URL, first record wins
+    CU_ASSERT_EQUAL(archive_append(archive, "http://example.com/empty", g_header, strlen(g_header), NULL, 0), 0);
+    CU_ASSERT_EQUAL(archive_append(archive, "http://example.com/7", g_header, strlen(g_header), "again", 5), 0);
+
+    CU_ASSERT_EQUAL_FATAL(archive_close(archive), 0);
+
+    archive_reader_t* reader = NULL;
+    CU_ASSERT_EQUAL_FATAL(archive_reader_open(g_path, &reader), 0);
+
+    for (int i = 0; i < 1000; i += 37) {
+        snprintf(url, sizeof(url), "http://example.com/%d", i);
+        snprintf(body, sizeof(body), "body of %d", i);
+
+        size_t length = 0;
+        char* stored = read_body(reader, url, &length);
+        CU_ASSERT_PTR_NOT_NULL(stored);
+        CU_ASSERT_EQUAL(length, strlen(body));
+        CU_ASSERT_STRING_EQUAL(stored, body);
+        free(stored);
+    }
+
+    size_t length = 0;
+    char* stored = read_body(reader, "http://example.com/7", &length);
+    CU_ASSERT_STRING_EQUAL(stored, "body of 7");
+    free(stored);
+
+    stored = read_body(reader, "http://example.com/empty", &length);
+    CU_ASSERT_PTR_NOT_NULL(stored);
+    CU_ASSERT_EQUAL(length, 0);
+    free(stored);
+
+    uint64_t offset = 0;
+    CU_ASSERT_EQUAL(archive_reader_find(reader, "http://example.com/1000", &offset, &offset), ENOENT);
+
+    archive_reader_close(reader);
+}
+
+static void test_record_format(void)
+{
+    archive_t* archive = NULL;
+    CU_ASSERT_EQUAL_FATAL(archive_open(g_path, &archive), 0);
+    CU_ASSERT_EQUAL(archive_append(archive, "http://example.com/", g_header, strlen(g_header), "hello", 5), 0);
+    CU_ASSERT_EQUAL_FATAL(archive_close(archive), 0);
+
+    FILE* file = fopen(g_path, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+
+    char contents[1024] = {0};
+    size_t size = fread(contents, 1, sizeof(contents) - 1, file);
+    fclose(file);
+
+    CU_ASSERT_EQUAL(strncmp(contents, "WARC/1.1\r\n", 10), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(contents, "WARC-Type: response\r\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(contents, "WARC-Target-URI: http://example.com/\r\n"));
+
+    char length[64];
+    snprintf(length, sizeof(length), "Content-Length: %zu\r\n\r\n", strlen(g_header) + 5);
+    CU_ASSERT_PTR_NOT_NULL(strstr(contents, length));
+
+    // Record block is the reply itself followed by record separator
+    CU_ASSERT_TRUE(size > strlen(g_header) + 9);
+    CU_ASSERT_EQUAL(memcmp(contents + size - strlen(g_header) - 9, g_header, strlen(g_header)), 0);
+    CU_ASSERT_EQUAL(memcmp(contents + size - 9, "hello\r\n\r\n", 9), 0);
+}
+
+static void test_hash_collision(void)
+{
+    archive_t* archive = NULL;
+    CU_ASSERT_EQUAL_FATAL(archive_open(g_path, &archive), 0);
+    CU_ASSERT_EQUAL(archive_append(archive, "http://example.com/a", g_header, strlen(g_header), "first", 5), 0);
+    CU_ASSERT_EQUAL(archive_append(archive, "http://example.com/b", g_header, strlen(g_header), "second", 6), 0);
+    CU_ASSERT_EQUAL_FATAL(archive_close(archive), 0);
+
+    char* index_path = NULL;
+    CU_ASSERT_FATAL(asprintf(&index_path, "%s%s", g_path, ARCHIVE_INDEX_SUFFIX) > 0);
+
+    // Give both records the hash of the second URL, archive order keeps index sorted
+    struct {
+        archive_index_header_t header;
+        archive_index_entry_t entries[2];
+    } index;
+
+    FILE* file = fopen(index_path, "r+");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    CU_ASSERT_EQUAL(fread(&index, sizeof(index), 1, file), 1);
+    CU_ASSERT_EQUAL(index.header.count, 2);
+
+    index.entries[0].url_hash = index.entries[1].url_hash = hash_string("http://example.com/b");
+    rewind(file);
+    CU_ASSERT_EQUAL(fwrite(&index, sizeof(index), 1, file), 1);
+    fclose(file);
+    free(index_path);
+
+    archive_reader_t* reader = NULL;
+    CU_ASSERT_EQUAL_FATAL(archive_reader_open(g_path, &reader), 0);
+
+    // First entry of the hash belongs to another URL and is skipped
+    size_t length = 0;
+    char* stored = read_body(reader, "http://example.com/b", &length);
+    CU_ASSERT_PTR_NOT_NULL(stored);
+    CU_ASSERT_EQUAL(length, 6);
+    CU_ASSERT_STRING_EQUAL(stored, "second");
+    free(stored);
+
+    // Hash of the first URL is no longer in the index
+    uint64_t offset = 0;
+    CU_ASSERT_EQUAL(archive_reader_find(reader, "http://example.com/a", &offset, &offset), ENOENT);
+
+    archive_reader_close(reader);
+}
+
+static void test_bad_index(void)
+{
+    archive_reader_t* reader = NULL;
+
+    char* index_path = NULL;
+    CU_ASSERT_FATAL(asprintf(&index_path, "%s%s", g_path, ARCHIVE_INDEX_SUFFIX) > 0);
+
+    FILE* file = fopen(index_path, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+    fwrite("HGETIDX2\x05\0\0\0\0\0\0\0", 1, 16, file);
+    fclose(file);
+
+    CU_ASSERT_EQUAL(archive_reader_open(g_path, &reader), EINVAL);
+
+    unlink(index_path);
+    CU_ASSERT_NOT_EQUAL(archive_reader_open(g_path, &reader), 0);
+
+    free(index_path);
+}
+
+int main(void)
+{
+    int error = 0;
+
+    int fd = mkstemp(g_path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return errno;
+    }
+    close(fd);
+
+    error = CU_initialize_registry();
+    if (error) {
+        goto error_out;
+    }
+
+    CU_pSuite suite = CU_add_suite("Archive", NULL, NULL);
+    if (!suite) {
+        error = CU_get_error();
+        goto error_out;
+    }
+
+    CU_add_test(suite, "round trip", test_round_trip);
+    CU_add_test(suite, "record format", test_record_format);
+    CU_add_test(suite, "hash collision", test_hash_collision);
+    CU_add_test(suite, "bad index", test_bad_index);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    error = CU_get_error();
+
+error_out:
+    CU_cleanup_registry();
+    unlink(g_path);
+    return error;
+}
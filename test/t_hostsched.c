@@ -0,0 +1,376 @@
+/**
+ *  @brief  Per host scheduler unit tests
+ */
+
+#include "hostsched.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/*************************************************************************************/
+
+#define TEST_ITEMS      256
+#define TEST_LATENCY    10
+
+static sched_item_t g_items[TEST_ITEMS];
+
+/*
+ * Scheduler with all test items queued for a single host
+ */
+static sched_t* make_sched(const sched_options_t* opts)
+{
+    sched_t* sched = NULL;
+    CU_ASSERT_EQUAL(sched_init(opts, &sched), 0);
+
+    memset(g_items, 0, sizeof(g_items));
+    for (size_t i = 0; i < TEST_ITEMS; ++i) {
+        CU_ASSERT_EQUAL(sched_add(sched, &g_items[i], "example.com:80"), 0);
+    }
+
+    return sched;
+}
+
+/*
+ * Start as many items as host limit allows right now
+ */
+static size_t start_items(sched_t* sched, sched_item_t** started, uint64_t now)
+{
+    size_t count = 0;
+    int error = 0;
+
+    sched_item_t* item = NULL;
+    while ((item = sched_next(sched, now, &error)) != NULL) {
+        CU_ASSERT_EQUAL(error, 0);
+        started[count++] = item;
+    }
+
+    return count;
+}
+
+static void finish_items(sched_t* sched, sched_item_t** started, size_t count, sched_result_t result, uint64_t now)
+{
+    for (size_t i = 0; i < count; ++i) {
+        sched_done(sched, started[i], result, TEST_LATENCY, now);
+    }
+}
+
+/*
+ * Item that has to be failed fast because breaker is open
+ */
+static bool next_fails_fast(sched_t* sched, uint64_t now)
+{
+    int error = 0;
+    sched_item_t* item = sched_next(sched, now, &error);
+    return item != NULL && error == EHOSTDOWN;
+}
+
+/*************************************************************************************/
+
+static void test_additive_increase(void)
+{
+    sched_item_t* started[TEST_ITEMS];
+    sched_options_t opts;
+    sched_options_init(&opts);
+    opts.max_per_host = 8;
+
+    sched_t* sched = make_sched(&opts);
+
+    // Below the threshold every success adds one, so limit doubles per round
+    size_t expected[] = { 1, 2, 4, 8, 8, 8 };
+    for (size_t round = 0; round < sizeof(expected) / sizeof(*expected); ++round) {
+        size_t count = start_items(sched, started, 0);
+        CU_ASSERT_EQUAL(count, expected[round]);
+        finish_items(sched, started, count, SCHED_SUCCESS, 0);
+    }
+
+    sched_free(sched);
+
+    // Above the threshold limit grows by at most one per round
+    opts.max_per_host = 16;
+    sched = make_sched(&opts);
+
+    size_t count = 0;
+    while ((count = start_items(sched, started, 0)) < 16) {
+        finish_items(sched, started, count, SCHED_SUCCESS, 0);
+    }
+
+    sched_done(sched, started[0], SCHED_FAILURE, 0, 0);
+    finish_items(sched, started + 1, count - 1, SCHED_ABORTED, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 8);
+    finish_items(sched, started, count, SCHED_SUCCESS, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 8);
+    finish_items(sched, started, count, SCHED_SUCCESS, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 9);
+    finish_items(sched, started, count, SCHED_ABORTED, 0);
+
+    sched_free(sched);
+}
+
+static void test_multiplicative_decrease(void)
+{
+    sched_item_t* started[TEST_ITEMS];
+    sched_options_t opts;
+    sched_options_init(&opts);
+    opts.max_per_host = 16;
+
+    sched_t* sched = make_sched(&opts);
+
+    size_t count = 0;
+    while ((count = start_items(sched, started, 0)) < 16) {
+        finish_items(sched, started, count, SCHED_SUCCESS, 0);
+    }
+
+    // Failures of requests started together halve the limit once
+    finish_items(sched, started, 4, SCHED_FAILURE, 0);
+    finish_items(sched, started + 4, count - 4, SCHED_ABORTED, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 8);
+
+    // Next epoch halves again
+    sched_done(sched, started[0], SCHED_FAILURE, 0, 0);
+    finish_items(sched, started + 1, count - 1, SCHED_ABORTED, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 4);
+
+    // Latency well above the best seen is a congestion signal too
+    finish_items(sched, started, count - 1, SCHED_SUCCESS, 0);
+    sched_done(sched, started[count - 1], SCHED_SUCCESS, 10 * TEST_LATENCY, 0);
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 2);
+    finish_items(sched, started, count, SCHED_ABORTED, 0);
+
+    // Limit never drops below one
+    for (size_t i = 0; i < 4; ++i) {
+        count = start_items(sched, started, 0);
+        CU_ASSERT_EQUAL(count, (i == 0 ? 2 : 1));
+        finish_items(sched, started, count, SCHED_FAILURE, 0);
+    }
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 1);
+    finish_items(sched, started, count, SCHED_ABORTED, 0);
+
+    sched_free(sched);
+}
+
+static void test_breaker(void)
+{
+    sched_item_t* started[TEST_ITEMS];
+    sched_options_t opts;
+    sched_options_init(&opts);
+    opts.breaker_threshold = 3;
+    opts.breaker_cooldown = 1000;
+
+    sched_t* sched = make_sched(&opts);
+    uint64_t now = 0;
+
+    // Trips after threshold consecutive failures
+    for (size_t i = 0; i < 3; ++i) {
+        size_t count = start_items(sched, started, now);
+        CU_ASSERT_EQUAL(count, 1);
+        finish_items(sched, started, count, SCHED_FAILURE, now);
+    }
+
+    CU_ASSERT_TRUE(next_fails_fast(sched, now));
+    CU_ASSERT_TRUE(next_fails_fast(sched, now + 999));
+
+    // Half open lets a single probe through after cooldown
+    now += 1000;
+    size_t count = start_items(sched, started, now);
+    CU_ASSERT_EQUAL(count, 1);
+
+    // Failed probe doubles cooldown
+    finish_items(sched, started, count, SCHED_FAILURE, now);
+    CU_ASSERT_TRUE(next_fails_fast(sched, now + 1999));
+
+    now += 2000;
+    count = start_items(sched, started, now);
+    CU_ASSERT_EQUAL(count, 1);
+    finish_items(sched, started, count, SCHED_FAILURE, now);
+
+    // Cooldown doubling is capped
+    unsigned cooldown = 4000;
+    for (size_t i = 0; i < 6; ++i) {
+        CU_ASSERT_TRUE(next_fails_fast(sched, now + cooldown - 1));
+
+        now += cooldown;
+        count = start_items(sched, started, now);
+        CU_ASSERT_EQUAL(count, 1);
+        finish_items(sched, started, count, SCHED_FAILURE, now);
+
+        cooldown = (cooldown * 2 > 16000 ? 16000 : cooldown * 2);
+    }
+
+    // Successful probe closes breaker
+    now += 16000;
+    count = start_items(sched, started, now);
+    CU_ASSERT_EQUAL(count, 1);
+    finish_items(sched, started, count, SCHED_SUCCESS, now);
+
+    // Success in between resets failure count, breaker trips on third failure in a row with configured cooldown
+    const sched_result_t results[] = { SCHED_FAILURE, SCHED_SUCCESS, SCHED_FAILURE, SCHED_FAILURE, SCHED_FAILURE };
+    for (size_t i = 0; i < sizeof(results) / sizeof(*results); ++i) {
+        count = start_items(sched, started, now);
+        CU_ASSERT_TRUE(count >= 1);
+        sched_done(sched, started[0], results[i], TEST_LATENCY, now);
+        finish_items(sched, started + 1, count - 1, SCHED_ABORTED, now);
+    }
+
+    CU_ASSERT_TRUE(next_fails_fast(sched, now + 999));
+
+    now += 1000;
+    count = start_items(sched, started, now);
+    CU_ASSERT_EQUAL(count, 1);
+    finish_items(sched, started, count, SCHED_SUCCESS, now);
+
+    sched_free(sched);
+}
+
+static void test_move(void)
+{
+    sched_item_t* started[TEST_ITEMS];
+    sched_options_t opts;
+    sched_options_init(&opts);
+    opts.breaker_threshold = 1;
+
+    sched_t* sched = make_sched(&opts);
+    int error = 0;
+
+    size_t count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 1);
+    CU_ASSERT_STRING_EQUAL(sched_item_host(started[0]), "example.com:80");
+
+    // Moved item frees its slot at old host and waits for a turn at the new one with retries counted anew
+    sched_item_t* moved = started[0];
+    CU_ASSERT_EQUAL(sched_move(sched, moved, "www.example.com:443", SCHED_SUCCESS, TEST_LATENCY, 0), 0);
+    CU_ASSERT_EQUAL(moved->attempts, 0);
+    CU_ASSERT_STRING_EQUAL(sched_item_host(moved), "www.example.com:443");
+
+    count = start_items(sched, started, 0);
+    CU_ASSERT_EQUAL(count, 3);
+
+    bool found = false;
+    for (size_t i = 0; i < count; ++i) {
+        found = found || (started[i] == moved);
+    }
+    CU_ASSERT_TRUE(found);
+    CU_ASSERT_EQUAL(moved->attempts, 1);
+
+    // Failure is accounted to the host that was actually contacted
+    sched_done(sched, moved, SCHED_FAILURE, 0, 0);
+
+    sched_item_t* other = (started[0] != moved ? started[0] : started[1]);
+    CU_ASSERT_EQUAL(sched_move(sched, other, "www.example.com:443", SCHED_SUCCESS, TEST_LATENCY, 0), 0);
+
+    // New host fails fast, old host is healthy and has room for more
+    size_t nfastfail = 0, nstarted = 0;
+    sched_item_t* item = NULL;
+    while ((item = sched_next(sched, 0, &error)) != NULL) {
+        if (item == other) {
+            CU_ASSERT_EQUAL(error, EHOSTDOWN);
+            ++nfastfail;
+        } else {
+            CU_ASSERT_EQUAL(error, 0);
+            CU_ASSERT_STRING_EQUAL(sched_item_host(item), "example.com:80");
+            ++nstarted;
+        }
+    }
+
+    CU_ASSERT_EQUAL(nfastfail, 1);
+    CU_ASSERT_TRUE(nstarted >= 1);
+
+    sched_free(sched);
+}
+
+static void test_backoff_bounds(void)
+{
+    sched_options_t opts;
+    sched_options_init(&opts);
+    opts.backoff_base = 100;
+    opts.backoff_max = 1000;
+
+    sched_t* sched = NULL;
+    CU_ASSERT_EQUAL_FATAL(sched_init(&opts, &sched), 0);
+
+    sched_item_t item;
+    memset(&item, 0, sizeof(item));
+
+    for (unsigned attempts = 1; attempts <= 40; ++attempts) {
+        uint64_t expected = 100;
+        for (unsigned i = 1; i < attempts && expected < 1000; ++i) {
+            expected *= 2;
+        }
+        if (expected > 1000) {
+            expected = 1000;
+        }
+
+        item.attempts = attempts;
+
+        uint64_t min = UINT64_MAX, max = 0;
+        for (size_t i = 0; i < 1000; ++i) {
+            uint64_t backoff = sched_backoff(sched, &item);
+            min = (backoff < min ? backoff : min);
+            max = (backoff > max ? backoff : max);
+        }
+
+        // Jitter stays within upper half of exponential backoff and actually spreads retries
+        CU_ASSERT_TRUE(min >= expected / 2);
+        CU_ASSERT_TRUE(max <= expected);
+        CU_ASSERT_TRUE(max > min);
+    }
+
+    sched_free(sched);
+
+    opts.backoff_base = 0;
+    CU_ASSERT_EQUAL_FATAL(sched_init(&opts, &sched), 0);
+
+    item.attempts = 3;
+    CU_ASSERT_EQUAL(sched_backoff(sched, &item), 0);
+
+    sched_free(sched);
+}
+
+int main(void)
+{
+    int error = 0;
+
+    error = CU_initialize_registry();
+    if (error) {
+        goto error_out;
+    }
+
+    CU_pSuite suite = CU_add_suite("Host scheduler", NULL, NULL);
+    if (!suite) {
+        error = CU_get_error();
+        goto error_out;
+    }
+
+    CU_add_test(suite, "additive increase", test_additive_increase);
+    CU_add_test(suite, "multiplicative decrease", test_multiplicative_decrease);
+    CU_add_test(suite, "circuit breaker", test_breaker);
+    CU_add_test(suite, "move to another host", test_move);
+    CU_add_test(suite, "backoff bounds", test_backoff_bounds);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    error = CU_get_error();
+
+error_out:
+    CU_cleanup_registry();
+    return error;
+}
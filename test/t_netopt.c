@@ -0,0 +1,189 @@
+/**
+ *  @brief  Source address pool unit tests, need 127.0.0.1-127.0.0.3 which Linux routes to loopback
+ */
+
+#define _GNU_SOURCE
+
+#include "netopt.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/*************************************************************************************/
+
+#if !defined(IP_BIND_ADDRESS_NO_PORT)
+#   define IP_BIND_ADDRESS_NO_PORT  24
+#endif
+
+/*
+ * Loopback listener on ephemeral port
+ */
+static int listen_loopback(struct sockaddr_in* out_addr)
+{
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    socklen_t addrlen = sizeof(*out_addr);
+    memset(out_addr, 0, sizeof(*out_addr));
+    out_addr->sin_family = AF_INET;
+    out_addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(sockfd, (struct sockaddr*)out_addr, sizeof(*out_addr)) ||
+        listen(sockfd, 16) ||
+        getsockname(sockfd, (struct sockaddr*)out_addr, &addrlen)) {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+static in_addr_t local_address(int sockfd, in_port_t* out_port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+
+    CU_ASSERT_EQUAL(getsockname(sockfd, (struct sockaddr*)&addr, &addrlen), 0);
+    if (out_port) {
+        *out_port = ntohs(addr.sin_port);
+    }
+
+    return ntohl(addr.sin_addr.s_addr);
+}
+
+/*************************************************************************************/
+
+static void test_round_robin(void)
+{
+    net_options_t opts;
+    net_options_init(&opts);
+    CU_ASSERT_EQUAL(net_options_add_srcaddrs(&opts, "127.0.0.1,127.0.0.2,127.0.0.3"), 0);
+    CU_ASSERT_EQUAL(opts.nsrcaddrs, 3);
+    opts.next_srcaddr = 0;
+
+    struct sockaddr_in dst;
+    int lsock = listen_loopback(&dst);
+    CU_ASSERT_TRUE_FATAL(lsock >= 0);
+
+    for (size_t i = 0; i < 9; ++i) {
+        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        CU_ASSERT_TRUE_FATAL(sockfd >= 0);
+        CU_ASSERT_EQUAL(net_options_apply(&opts, sockfd, AF_INET), 0);
+
+        // Bound without a port, it is only picked by connect
+        int on = 0;
+        socklen_t len = sizeof(on);
+        CU_ASSERT_EQUAL(getsockopt(sockfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, &len), 0);
+        CU_ASSERT_EQUAL(on, 1);
+
+        in_port_t port = 0;
+        CU_ASSERT_EQUAL(local_address(sockfd, &port), INADDR_LOOPBACK + (i % 3));
+        CU_ASSERT_EQUAL(port, 0);
+
+        CU_ASSERT_EQUAL(connect(sockfd, (struct sockaddr*)&dst, sizeof(dst)), 0);
+        CU_ASSERT_EQUAL(local_address(sockfd, &port), INADDR_LOOPBACK + (i % 3));
+        CU_ASSERT_NOT_EQUAL(port, 0);
+
+        // Server sees the pool address as peer
+        struct sockaddr_in peer;
+        socklen_t peerlen = sizeof(peer);
+        int csock = accept(lsock, (struct sockaddr*)&peer, &peerlen);
+        CU_ASSERT_TRUE(csock >= 0);
+        CU_ASSERT_EQUAL(ntohl(peer.sin_addr.s_addr), INADDR_LOOPBACK + (i % 3));
+        CU_ASSERT_EQUAL(ntohs(peer.sin_port), port);
+
+        close(csock);
+        close(sockfd);
+    }
+
+    // Pool has no address of this family, socket is left unbound
+    int sockfd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (sockfd >= 0) {
+        CU_ASSERT_EQUAL(net_options_apply(&opts, sockfd, AF_INET6), 0);
+        close(sockfd);
+    }
+
+    close(lsock);
+    net_options_free(&opts);
+}
+
+static void test_fallback_counters(void)
+{
+    net_options_t opts;
+    net_options_init(&opts);
+
+    // Documentation address is not configured on any interface
+    CU_ASSERT_EQUAL(net_options_add_srcaddrs(&opts, "192.0.2.1,127.0.0.2"), 0);
+    opts.next_srcaddr = 0;
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    CU_ASSERT_TRUE_FATAL(sockfd >= 0);
+
+    int error = net_options_apply(&opts, sockfd, AF_INET);
+    CU_ASSERT_EQUAL(error, EADDRNOTAVAIL);
+    CU_ASSERT_TRUE(net_options_count_failure(&opts, error));
+    CU_ASSERT_EQUAL(opts.addrnotavail_failures, 1);
+    CU_ASSERT_EQUAL(opts.addrinuse_failures, 0);
+    close(sockfd);
+
+    // Retry with a new socket moves on to the next pool address
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    CU_ASSERT_TRUE_FATAL(sockfd >= 0);
+    CU_ASSERT_EQUAL(net_options_apply(&opts, sockfd, AF_INET), 0);
+    CU_ASSERT_EQUAL(local_address(sockfd, NULL), INADDR_LOOPBACK + 1);
+    close(sockfd);
+
+    CU_ASSERT_TRUE(net_options_count_failure(&opts, EADDRINUSE));
+    CU_ASSERT_TRUE(net_options_count_failure(&opts, EADDRINUSE));
+    CU_ASSERT_EQUAL(opts.addrinuse_failures, 2);
+
+    // Anything else is not an address exhaustion and is not retried with next address
+    CU_ASSERT_FALSE(net_options_count_failure(&opts, ECONNREFUSED));
+    CU_ASSERT_FALSE(net_options_count_failure(&opts, 0));
+    CU_ASSERT_EQUAL(opts.addrinuse_failures, 2);
+    CU_ASSERT_EQUAL(opts.addrnotavail_failures, 1);
+
+    CU_ASSERT_EQUAL(net_options_add_srcaddrs(&opts, "localhost"), EINVAL);
+
+    net_options_free(&opts);
+}
+
+int main(void)
+{
+    int error = 0;
+
+    error = CU_initialize_registry();
+    if (error) {
+        goto error_out;
+    }
+
+    CU_pSuite suite = CU_add_suite("Source address pool", NULL, NULL);
+    if (!suite) {
+        error = CU_get_error();
+        goto error_out;
+    }
+
+    CU_add_test(suite, "round robin", test_round_robin);
+    CU_add_test(suite, "fallback counters", test_fallback_counters);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    error = CU_get_error();
+
+error_out:
+    CU_cleanup_registry();
+    return error;
+}
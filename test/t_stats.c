@@ -0,0 +1,195 @@
+/**
+ *  @brief  Statistics unit tests
+ */
+
+#define _GNU_SOURCE
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/*************************************************************************************/
+
+static char g_path[] = "/tmp/t_stats_XXXXXX";
+
+static void test_buckets(void)
+{
+    size_t prev = 0;
+    for (uint64_t value = 0; value < (1 << 20); ++value) {
+        size_t bucket = hdr_bucket(value);
+        CU_ASSERT_TRUE(bucket == prev || bucket == prev + 1);
+        CU_ASSERT_TRUE(bucket < HDR_BUCKETS);
+        prev = bucket;
+    }
+
+    CU_ASSERT_EQUAL(hdr_bucket(UINT64_MAX), HDR_BUCKETS - 1);
+    CU_ASSERT_EQUAL(hdr_bucket((1ull << HDR_MAX_VALUE_BITS) - 1), HDR_BUCKETS - 1);
+}
+
+static void test_quantiles(void)
+{
+    hdr_histogram_t h;
+    memset(&h, 0, sizeof(h));
+
+    CU_ASSERT_EQUAL(hdr_quantile(&h, 0.5), 0);
+
+    // Exact below sub bucket count
+    for (uint64_t value = 1; value <= 20; ++value) {
+        hdr_record(&h, value);
+    }
+
+    CU_ASSERT_EQUAL(h.count, 20);
+    CU_ASSERT_EQUAL(h.sum, 210);
+    CU_ASSERT_EQUAL(h.max, 20);
+    CU_ASSERT_EQUAL(hdr_quantile(&h, 0.5), 10);
+    CU_ASSERT_EQUAL(hdr_quantile(&h, 1.0), 20);
+    CU_ASSERT_EQUAL(hdr_quantile(&h, 0.0), 1);
+
+    // Relative error stays within one sub bucket over a wide range
+    memset(&h, 0, sizeof(h));
+    for (uint64_t value = 1; value <= 1000000; ++value) {
+        hdr_record(&h, value);
+    }
+
+    const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(*quantiles); ++i) {
+        double expected = quantiles[i] * 1000000;
+        double actual = hdr_quantile(&h, quantiles[i]);
+        CU_ASSERT_TRUE(actual >= expected);
+        CU_ASSERT_TRUE(actual <= expected * (1 + 2.0 / HDR_SUB_BUCKETS));
+    }
+
+    CU_ASSERT_EQUAL(hdr_quantile(&h, 1.0), 1000000);
+}
+
+static void test_classify(void)
+{
+    CU_ASSERT_EQUAL(stats_classify(0, 404), STATS_ERROR_HTTP_4XX);
+    CU_ASSERT_EQUAL(stats_classify(0, 503), STATS_ERROR_HTTP_5XX);
+    CU_ASSERT_EQUAL(stats_classify(0, 301), STATS_ERROR_HTTP_OTHER);
+    CU_ASSERT_EQUAL(stats_classify(ETIMEDOUT, 0), STATS_ERROR_TIMEOUT);
+    CU_ASSERT_EQUAL(stats_classify(ETIMEDOUT, 200), STATS_ERROR_TIMEOUT);
+    CU_ASSERT_EQUAL(stats_classify(ECONNREFUSED, 0), STATS_ERROR_CONNECT);
+    CU_ASSERT_EQUAL(stats_classify(-2, 0), STATS_ERROR_CONNECT);
+    CU_ASSERT_EQUAL(stats_classify(ECONNRESET, 0), STATS_ERROR_RESET);
+    CU_ASSERT_EQUAL(stats_classify(EPROTO, 0), STATS_ERROR_PROTOCOL);
+    CU_ASSERT_EQUAL(stats_classify(EHOSTDOWN, 0), STATS_ERROR_HOST_DOWN);
+    CU_ASSERT_EQUAL(stats_classify(ENOMEM, 0), STATS_ERROR_OTHER);
+}
+
+static void test_options(void)
+{
+    stats_options_t opts;
+    stats_options_init(&opts);
+
+    CU_ASSERT_FALSE(stats_enabled(&opts));
+    CU_ASSERT_EQUAL(opts.interval, 10000);
+
+    CU_ASSERT_EQUAL(stats_options_parse(&opts, "file=/tmp/a,socket=/tmp/b,interval=500"), 0);
+    CU_ASSERT_TRUE(stats_enabled(&opts));
+    CU_ASSERT_STRING_EQUAL(opts.path, "/tmp/a");
+    CU_ASSERT_STRING_EQUAL(opts.socket, "/tmp/b");
+    CU_ASSERT_EQUAL(opts.interval, 500);
+
+    CU_ASSERT_EQUAL(stats_options_parse(&opts, "interval=0"), EINVAL);
+    CU_ASSERT_EQUAL(stats_options_parse(&opts, "file"), EINVAL);
+    CU_ASSERT_EQUAL(stats_options_parse(&opts, "foo=1"), EINVAL);
+
+    stats_options_free(&opts);
+}
+
+static void test_write(void)
+{
+    stats_options_t opts;
+    stats_options_init(&opts);
+    opts.path = g_path;
+
+    stats_t stats;
+    stats_init(&stats, 1000);
+
+    stats.requests = 10;
+    stats.failures = 2;
+    stats.errors[STATS_ERROR_TIMEOUT] = 2;
+    stats.bytes = 4096;
+    for (uint64_t value = 1; value <= 10; ++value) {
+        hdr_record(&stats.duration, value * 100);
+    }
+
+    stats_write(&stats, &opts, 3000, 3, 1);
+
+    CU_ASSERT_EQUAL(stats.last_write_time, 3000);
+    CU_ASSERT_EQUAL(stats.last_requests, 10);
+
+    FILE* file = fopen(g_path, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+
+    char text[16384];
+    size_t size = fread(text, 1, sizeof(text) - 1, file);
+    text[size] = '\0';
+    fclose(file);
+
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_requests_total{result=\"success\"} 8\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_requests_total{result=\"failure\"} 2\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_errors_total{class=\"timeout\"} 2\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_requests_per_second 5\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_received_bytes_per_second 2048\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_inflight 3\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "# TYPE httpget_duration_seconds summary\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_duration_seconds{quantile=\"0.999\"} 1.000\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_duration_seconds_sum 5.500\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "httpget_duration_seconds_count 10\n"));
+
+    // Every sample line is a name with optional labels and a value
+    for (char* line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        if (line[0] != '#') {
+            CU_ASSERT_EQUAL(strncmp(line, "httpget_", 8), 0);
+            CU_ASSERT_PTR_NOT_NULL(strrchr(line, ' '));
+        }
+    }
+}
+
+int main(void)
+{
+    int error = 0;
+
+    int fd = mkstemp(g_path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return errno;
+    }
+    close(fd);
+
+    error = CU_initialize_registry();
+    if (error) {
+        goto error_out;
+    }
+
+    CU_pSuite suite = CU_add_suite("Stats", NULL, NULL);
+    if (!suite) {
+        error = CU_get_error();
+        goto error_out;
+    }
+
+    CU_add_test(suite, "buckets", test_buckets);
+    CU_add_test(suite, "quantiles", test_quantiles);
+    CU_add_test(suite, "classify", test_classify);
+    CU_add_test(suite, "options", test_options);
+    CU_add_test(suite, "write", test_write);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    error = CU_get_error();
+
+error_out:
+    CU_cleanup_registry();
+    unlink(g_path);
+    return error;
+}
@@ -0,0 +1,175 @@
+/**
+ *  @brief  Timer wheel unit tests
+ */
+
+#include "timer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/*************************************************************************************/
+
+/*
+ * Test timer recording the tick it actually fired at
+ */
+typedef struct test_timer
+{
+    timer_entry_t entry;
+    uint64_t fired_at;
+    size_t nfired;
+} test_timer_t;
+
+static timer_wheel_t g_wheel;
+
+static void on_test_timer(timer_entry_t* entry, void* ctx)
+{
+    test_timer_t* timer = (test_timer_t*)entry;
+    timer->fired_at = g_wheel.current - 1; // Wheel has already moved past the tick being processed
+    ++timer->nfired;
+}
+
+static void test_expiration_ticks(void)
+{
+    const uint64_t start = 1000003;
+    const uint64_t deltas[] = { 0, 1, 255, 256, 257, 1000, 65535, 65536, 70000, (1 << 24) + 5 };
+    test_timer_t timers[sizeof(deltas) / sizeof(*deltas)];
+
+    timer_wheel_init(&g_wheel, start);
+
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(*deltas); ++i) {
+        timer_init(&timers[i].entry, on_test_timer);
+        timers[i].nfired = 0;
+        timer_schedule(&g_wheel, &timers[i].entry, start + deltas[i]);
+        CU_ASSERT_TRUE(timer_pending(&timers[i].entry));
+    }
+
+    CU_ASSERT_EQUAL(g_wheel.count, sizeof(deltas) / sizeof(*deltas));
+
+    // Advance in uneven steps to catch timers that fire late or early
+    uint64_t now = start;
+    while (g_wheel.count > 0) {
+        now += 997;
+        timer_wheel_advance(&g_wheel, now, NULL);
+    }
+
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(*deltas); ++i) {
+        CU_ASSERT_EQUAL(timers[i].nfired, 1);
+        CU_ASSERT_EQUAL(timers[i].fired_at, start + deltas[i]);
+        CU_ASSERT_FALSE(timer_pending(&timers[i].entry));
+    }
+}
+
+static void test_cancel_and_reschedule(void)
+{
+    test_timer_t a, b;
+
+    timer_wheel_init(&g_wheel, 0);
+    timer_init(&a.entry, on_test_timer);
+    timer_init(&b.entry, on_test_timer);
+    a.nfired = b.nfired = 0;
+
+    timer_schedule(&g_wheel, &a.entry, 100);
+    timer_schedule(&g_wheel, &b.entry, 300);
+
+    // Rescheduling a pending timer moves it
+    timer_schedule(&g_wheel, &a.entry, 5000);
+    CU_ASSERT_EQUAL(g_wheel.count, 2);
+
+    timer_cancel(&g_wheel, &b.entry);
+    CU_ASSERT_FALSE(timer_pending(&b.entry));
+    CU_ASSERT_EQUAL(g_wheel.count, 1);
+
+    // Cancelling twice is harmless
+    timer_cancel(&g_wheel, &b.entry);
+    CU_ASSERT_EQUAL(g_wheel.count, 1);
+
+    CU_ASSERT_EQUAL(timer_wheel_advance(&g_wheel, 4999, NULL), 0);
+    CU_ASSERT_EQUAL(timer_wheel_advance(&g_wheel, 5000, NULL), 1);
+    CU_ASSERT_EQUAL(a.nfired, 1);
+    CU_ASSERT_EQUAL(a.fired_at, 5000);
+    CU_ASSERT_EQUAL(b.nfired, 0);
+}
+
+/*
+ * Timer that reschedules itself a number of times
+ */
+static void on_periodic_timer(timer_entry_t* entry, void* ctx)
+{
+    test_timer_t* timer = (test_timer_t*)entry;
+    if (++timer->nfired < 3) {
+        timer_schedule(&g_wheel, entry, g_wheel.current + 10);
+    }
+}
+
+static void test_reschedule_from_callback(void)
+{
+    test_timer_t timer;
+
+    timer_wheel_init(&g_wheel, 0);
+    timer_init(&timer.entry, on_periodic_timer);
+    timer.nfired = 0;
+
+    timer_schedule(&g_wheel, &timer.entry, 10);
+    timer_wheel_advance(&g_wheel, 1000, NULL);
+
+    CU_ASSERT_EQUAL(timer.nfired, 3);
+    CU_ASSERT_EQUAL(g_wheel.count, 0);
+}
+
+static void test_timeout(void)
+{
+    test_timer_t timer;
+
+    timer_wheel_init(&g_wheel, 0);
+    timer_init(&timer.entry, on_test_timer);
+    timer.nfired = 0;
+
+    CU_ASSERT_EQUAL(timer_wheel_timeout(&g_wheel, 0), -1);
+
+    timer_schedule(&g_wheel, &timer.entry, 42);
+    CU_ASSERT_EQUAL(timer_wheel_timeout(&g_wheel, 0), 42);
+
+    // Upper level timers wake us up no later than the next cascade
+    timer_schedule(&g_wheel, &timer.entry, 100000);
+    int64_t timeout = timer_wheel_timeout(&g_wheel, 0);
+    CU_ASSERT_TRUE(timeout > 0 && timeout <= TIMER_WHEEL_SLOTS);
+
+    // Past timers are due right away
+    timer_wheel_advance(&g_wheel, 500, NULL);
+    timer_schedule(&g_wheel, &timer.entry, 10);
+    CU_ASSERT_EQUAL(timer_wheel_timeout(&g_wheel, 500), 1);
+    CU_ASSERT_EQUAL(timer_wheel_advance(&g_wheel, 501, NULL), 1);
+}
+
+int main(void)
+{
+    int error = 0;
+
+    error = CU_initialize_registry();
+    if (error) {
+        goto error_out;
+    }
+
+    CU_pSuite suite = CU_add_suite("Timer wheel", NULL, NULL);
+    if (!suite) {
+        error = CU_get_error();
+        goto error_out;
+    }
+
+    CU_add_test(suite, "expiration ticks", test_expiration_ticks);
+    CU_add_test(suite, "cancel and reschedule", test_cancel_and_reschedule);
+    CU_add_test(suite, "reschedule from callback", test_reschedule_from_callback);
+    CU_add_test(suite, "timeout", test_timeout);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+
+    error = CU_get_error();
+
+error_out:
+    CU_cleanup_registry();
+    return error;
+}
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Local HTTP test server with fault injection.
+#
+# Paths:
+#   /size/<bytes>           reply with that many bytes of body
+#   /status/<code>          reply with given status code
+#   /retry-after/<seconds>  503 reply with Retry-After header
+#   /delay/<ms>             wait before replying
+#   /redirect/<code>?to=<location>  redirect reply, to / by default
+#   /chain/<n>              n relative redirects in a row, then a small body
+#   /stall                  send header and part of body, then hang
+#   /truncate/<bytes>       announce that many bytes of body, send half of it and close
+#   /trickle                send body one byte every 200 ms
+#   anything else           small text body
+#
+# Options make the whole server misbehave to emulate a degraded host:
+#   --fail-rate   fraction of requests answered with 503
+#   --delay       latency added to every request in ms
+#
+# With --cert and --key the server speaks HTTPS and hands out session tickets.
+
+import argparse
+import random
+import ssl
+import socketserver
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Handler(BaseHTTPRequestHandler):
+    # HTTP/1.1 is needed for keep-alive requests to be honored, replies tell if connection stays open
+    protocol_version = 'HTTP/1.1'
+    # Header and body go out in separate writes, Nagle would hold the body on kept connection
+    disable_nagle_algorithm = True
+
+    def log_message(self, format, *args):
+        if not self.server.quiet:
+            super().log_message(format, *args)
+
+    def reply(self, code, body=b'', headers=()):
+        self.send_response(code)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.send_header('Connection', 'close' if self.close_connection else 'keep-alive')
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        if self.server.delay:
+            time.sleep(self.server.delay / 1000)
+
+        if random.random() < self.server.fail_rate:
+            return self.reply(503, b'injected failure\n')
+
+        path, _, query = self.path.partition('?')
+        parts = path.strip('/').split('/')
+        arg = parts[1] if len(parts) > 1 else ''
+
+        if parts[0] == 'size':
+            return self.reply(200, b'x' * int(arg))
+        if parts[0] == 'status':
+            return self.reply(int(arg), b'status %s\n' % arg.encode())
+        if parts[0] == 'redirect':
+            location = urllib.parse.parse_qs(query).get('to', ['/'])[0]
+            return self.reply(int(arg), b'moved\n', [('Location', location)])
+        if parts[0] == 'chain':
+            if int(arg) > 0:
+                return self.reply(302, b'moved\n', [('Location', str(int(arg) - 1))])
+            return self.reply(200, b'end of chain\n')
+        if parts[0] == 'retry-after':
+            return self.reply(503, b'retry later\n', [('Retry-After', arg)])
+        if parts[0] == 'delay':
+            time.sleep(int(arg) / 1000)
+            return self.reply(200, b'delayed\n')
+        if parts[0] == 'stall':
+            self.close_connection = True
+            self.send_response(200)
+            self.end_headers()
+            self.wfile.write(b'partial')
+            self.wfile.flush()
+            time.sleep(3600)
+        if parts[0] == 'truncate':
+            self.close_connection = True
+            self.send_response(200)
+            self.send_header('Content-Length', arg)
+            self.end_headers()
+            self.wfile.write(b'x' * (int(arg) // 2))
+            return
+        if parts[0] == 'trickle':
+            self.close_connection = True
+            self.send_response(200)
+            self.end_headers()
+            for _ in range(1000):
+                self.wfile.write(b'.')
+                self.wfile.flush()
+                time.sleep(0.2)
+            return
+
+        return self.reply(200, b'ok %s\n' % self.path.encode())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='httpget test server')
+    parser.add_argument('--bind', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--fail-rate', type=float, default=0.0)
+    parser.add_argument('--delay', type=int, default=0)
+    parser.add_argument('--quiet', action='store_true')
+    parser.add_argument('--cert')
+    parser.add_argument('--key')
+    args = parser.parse_args()
+
+    socketserver.TCPServer.allow_reuse_address = True
+    ThreadingHTTPServer.request_queue_size = 1024
+    server = ThreadingHTTPServer((args.bind, args.port), Handler)
+    server.daemon_threads = True
+    server.fail_rate = args.fail_rate
+    server.delay = args.delay
+    server.quiet = args.quiet
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Check that TLS sessions are resumed on keep-alive connections, where replies end by Content-Length
+# and not by server closing the connection. Every request after the first one has to resume.
+# Usage: ./test/tlsresume.sh [requests]
+
+COUNT=${1:-8}
+PORT=18444
+DIR=$(mktemp -d)
+
+cleanup() {
+    [ -n "$SERVER" ] && kill $SERVER
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout $DIR/key.pem -out $DIR/cert.pem > /dev/null 2>&1 || exit 1
+
+python3 $(dirname $0)/testsrv.py --port $PORT --cert $DIR/cert.pem --key $DIR/key.pem --quiet &
+SERVER=$!
+sleep 1
+
+# Plain replies, a redirect that reuses its connection and one that has to reconnect
+for i in $(seq $COUNT); do echo "https://localhost:$PORT/size/$((i * 1000))"; done > $DIR/urls
+echo "https://localhost:$PORT/chain/2" >> $DIR/urls
+echo "https://localhost:$PORT/redirect/302?to=https://127.0.0.1:$PORT/size/10" >> $DIR/urls
+
+STATS=$(./httpget -i $DIR/urls -o $DIR -s "cafile=$DIR/cert.pem" 2>&1 > /dev/null | grep "^TLS handshakes")
+echo "$STATS"
+
+FULL=$(echo "$STATS" | sed -n 's/^TLS handshakes: \([0-9]*\) full.*/\1/p')
+RESUMED=$(echo "$STATS" | sed -n 's/.*; \([0-9]*\) resumed.*/\1/p')
+
+# Only the first request and the other host name of the same server take a full handshake
+if [ "$FULL" != "2" ] || [ "$RESUMED" != "$((COUNT + 1))" ]; then
+    echo "Expected 2 full and $((COUNT + 1)) resumed handshakes"
+    exit 1
+fi
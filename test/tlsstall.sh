@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Check that TLS handshake counts towards connect deadline. Server accepts connections but never answers
+# the ClientHello, so transfer has to time out in connect phase and not hang or blame first byte phase.
+# Usage: ./test/tlsstall.sh
+
+PORT=18445
+DIR=$(mktemp -d)
+
+cleanup() {
+    [ -n "$SERVER" ] && kill $SERVER
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+# Accepted sockets are kept open and never read
+python3 - $PORT <<'EOF' &
+import sys, socket
+sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+sock.bind(('127.0.0.1', int(sys.argv[1])))
+sock.listen(16)
+conns = []
+while True:
+    conns.append(sock.accept()[0])
+EOF
+SERVER=$!
+sleep 1
+
+for deadlines in "connect=500" "connect=500,firstbyte=200"; do
+    timeout 10 ./httpget -u "https://127.0.0.1:$PORT/" -o $DIR/out -s insecure -T "$deadlines" 2> $DIR/log
+    STATUS=$?
+    grep "timed out" $DIR/log
+
+    if [ $STATUS -eq 124 ]; then
+        echo "Stalled handshake was not timed out with -T $deadlines"
+        exit 1
+    elif ! grep -q "timed out in connect phase" $DIR/log; then
+        echo "Stalled handshake did not time out in connect phase with -T $deadlines"
+        exit 1
+    fi
+done
@@ -0,0 +1,193 @@
+#include "timer.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+/*************************************************************************************/
+
+#define TIMER_WHEEL_SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE       (((uint64_t)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+/*
+ * Slot index of tick at given level
+ */
+#define TIMER_WHEEL_INDEX(_tick_, _level_) \
+    (((_tick_) >> ((_level_) * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK)
+
+/*************************************************************************************/
+
+static void list_add(timer_entry_t** head, timer_entry_t* timer)
+{
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void list_del(timer_entry_t* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*
+ * Move whole list to a new head so entries can still unlink themselves from it
+ */
+static void list_move(timer_entry_t** from, timer_entry_t** to)
+{
+    *to = *from;
+    *from = NULL;
+    if (*to) {
+        (*to)->pprev = to;
+    }
+}
+
+/*
+ * Put timer into the slot of the lowest level that covers its expiration
+ */
+static void wheel_add(timer_wheel_t* wheel, timer_entry_t* timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < wheel->current) {
+        // Already expired, will go on the next tick
+        expires = wheel->current;
+    }
+
+    uint64_t delta = expires - wheel->current;
+
+    size_t level = 0;
+    while ((level < TIMER_WHEEL_LEVELS - 1) && (delta >> ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+        ++level;
+    }
+
+    list_add(&wheel->slots[level][TIMER_WHEEL_INDEX(expires, level)], timer);
+}
+
+/*
+ * Redistribute one higher level slot into lower levels
+ */
+static void wheel_cascade(timer_wheel_t* wheel, size_t level, size_t index)
+{
+    timer_entry_t* head = NULL;
+    list_move(&wheel->slots[level][index], &head);
+
+    while (head) {
+        timer_entry_t* timer = head;
+        list_del(timer);
+        wheel_add(wheel, timer);
+    }
+}
+
+/*************************************************************************************/
+
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now)
+{
+    assert(wheel != NULL);
+
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->current = now;
+}
+
+void timer_init(timer_entry_t* timer, void (*callback)(timer_entry_t* timer, void* ctx))
+{
+    assert(timer != NULL);
+
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+}
+
+void timer_schedule(timer_wheel_t* wheel, timer_entry_t* timer, uint64_t expires)
+{
+    assert(wheel != NULL);
+    assert(timer != NULL);
+
+    timer_cancel(wheel, timer);
+
+    if (expires > wheel->current + TIMER_WHEEL_RANGE) {
+        expires = wheel->current + TIMER_WHEEL_RANGE;
+    }
+
+    timer->expires = expires;
+    wheel_add(wheel, timer);
+    ++wheel->count;
+}
+
+void timer_cancel(timer_wheel_t* wheel, timer_entry_t* timer)
+{
+    assert(wheel != NULL);
+    assert(timer != NULL);
+
+    if (timer_pending(timer)) {
+        list_del(timer);
+        --wheel->count;
+    }
+}
+
+size_t timer_wheel_advance(timer_wheel_t* wheel, uint64_t now, void* ctx)
+{
+    assert(wheel != NULL);
+
+    size_t nexpired = 0;
+    while (wheel->current <= now)
+    {
+        size_t index = TIMER_WHEEL_INDEX(wheel->current, 0);
+
+        // Level wrapped, pull next slot of each upper level that wrapped as well
+        if (index == 0) {
+            for (size_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+                size_t level_index = TIMER_WHEEL_INDEX(wheel->current, level);
+                wheel_cascade(wheel, level, level_index);
+                if (level_index != 0) {
+                    break;
+                }
+            }
+        }
+
+        timer_entry_t* head = NULL;
+        list_move(&wheel->slots[0][index], &head);
+
+        // Timers scheduled from callbacks should not land into the slot being processed
+        ++wheel->current;
+
+        while (head) {
+            timer_entry_t* timer = head;
+            list_del(timer);
+            --wheel->count;
+            ++nexpired;
+
+            timer->callback(timer, ctx);
+        }
+    }
+
+    return nexpired;
+}
+
+int64_t timer_wheel_timeout(const timer_wheel_t* wheel, uint64_t now)
+{
+    assert(wheel != NULL);
+
+    if (wheel->count == 0) {
+        return -1;
+    }
+
+    uint64_t tick = wheel->current;
+    for (size_t i = 0; i < TIMER_WHEEL_SLOTS; ++i, ++tick) {
+        size_t index = TIMER_WHEEL_INDEX(tick, 0);
+        if ((wheel->slots[0][index] != NULL) || (index == 0 && i > 0)) {
+            break;
+        }
+    }
+
+    return (tick > now ? (int64_t)(tick - now) : 0);
+}
+
+/*************************************************************************************/
@@ -0,0 +1,96 @@
+/**
+ * @file timer.h
+ *
+ * Hierarchical timer wheel with millisecond ticks
+ */
+
+#ifndef _HTTPGET_TIMER_H_
+#define _HTTPGET_TIMER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_SLOT_BITS   8
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+
+/**
+ * @brief   Timer entry, meant to be embedded into the object it times
+ */
+typedef struct timer_entry
+{
+    struct timer_entry* next;
+    struct timer_entry** pprev;     // NULL when timer is not scheduled
+    uint64_t expires;               // Absolute tick
+    void (*callback)(struct timer_entry* timer, void* ctx);
+} timer_entry_t;
+
+/**
+ * @brief   Timer wheel
+ *
+ *          Level N has TIMER_WHEEL_SLOTS slots each covering 2^(N * TIMER_WHEEL_SLOT_BITS) ticks.
+ *          Timers are placed in a level by how far in the future they expire and cascade down
+ *          a level each time the level below it wraps. Scheduling and cancelling are O(1).
+ */
+typedef struct timer_wheel
+{
+    uint64_t current;               // Next tick to process
+    size_t count;                   // Scheduled timers
+    timer_entry_t* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/**
+ * @brief       Init empty wheel starting at @now@ tick.
+ */
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now);
+
+/**
+ * @brief       Init timer entry with a callback to call on expiration.
+ */
+void timer_init(timer_entry_t* timer, void (*callback)(timer_entry_t* timer, void* ctx));
+
+/**
+ * @brief       Schedule timer to expire at @expires@ tick, rescheduling it if it is already pending.
+ *              Timers in the past expire on the next @timer_wheel_advance@.
+ *              Timers beyond the wheel range are clamped to its end.
+ */
+void timer_schedule(timer_wheel_t* wheel, timer_entry_t* timer, uint64_t expires);
+
+/**
+ * @brief       Cancel timer if it is pending.
+ */
+void timer_cancel(timer_wheel_t* wheel, timer_entry_t* timer);
+
+/**
+ * @brief       Check if timer is scheduled.
+ */
+static inline bool timer_pending(const timer_entry_t* timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief       Advance wheel up to and including @now@ tick, calling callbacks of expired timers.
+ *              Callbacks are free to schedule or cancel any timers, including the one being called.
+ *
+ * @returns     Number of expired timers.
+ */
+size_t timer_wheel_advance(timer_wheel_t* wheel, uint64_t now, void* ctx);
+
+/**
+ * @brief       Upper bound on the number of ticks from @now@ until the next timer expires.
+ *              May return less than that when higher levels are due to cascade, never more.
+ *
+ * @returns     Number of ticks, -1 if there are no timers.
+ */
+int64_t timer_wheel_timeout(const timer_wheel_t* wheel, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include "tls.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+/*************************************************************************************/
+
+#define TLS_SESSION_BUCKETS     256
+
+/*
+ * Last session we have got from a host
+ */
+typedef struct tls_session_entry
+{
+    struct tls_session_entry* next;
+    char* hostkey;
+    SSL_SESSION* session;
+} tls_session_entry_t;
+
+struct tls_context
+{
+    tls_options_t opts;
+    SSL_CTX* ssl_ctx;
+
+    tls_session_entry_t* sessions[TLS_SESSION_BUCKETS];
+
+    size_t nfull;
+    size_t nresumed;
+    uint64_t full_time;             // Total handshake times in microseconds
+    uint64_t resumed_time;
+    size_t nktls_send;
+    size_t nktls_recv;
+};
+
+struct tls_conn
+{
+    tls_context_t* ctx;
+    SSL* ssl;
+    char* hostkey;
+
+    bool want_write;
+    bool resumed;
+    bool eof;                       // Peer has finished sending
+    uint64_t start_time;            // CLOCK_MONOTONIC microseconds
+    uint64_t handshake_time;
+};
+
+/*************************************************************************************/
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void tls_options_init(tls_options_t* opts)
+{
+    assert(opts != NULL);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->verify = true;
+    opts->resume = true;
+}
+
+int tls_options_parse(tls_options_t* opts, const char* spec)
+{
+    int error = 0;
+
+    if (!opts || !spec) {
+        return EINVAL;
+    }
+
+    char* list = strdup(spec);
+    if (!list) {
+        return ENOMEM;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name != NULL && !error; name = strtok_r(NULL, ",", &saveptr))
+    {
+        char* valstr = strchr(name, '=');
+        if (valstr) {
+            *valstr++ = '\0';
+        }
+
+        if (0 == strcmp(name, "insecure") && !valstr) {
+            opts->verify = false;
+        } else if (0 == strcmp(name, "noresume") && !valstr) {
+            opts->resume = false;
+        } else if (0 == strcmp(name, "ktls") && !valstr) {
+            opts->ktls = true;
+        } else if (0 == strcmp(name, "cafile") && valstr && *valstr) {
+            free(opts->cafile);
+            opts->cafile = strdup(valstr);
+            if (!opts->cafile) {
+                error = ENOMEM;
+            }
+        } else {
+            fprintf(stderr, "Unknown TLS option '%s'\n", name);
+            error = EINVAL;
+        }
+    }
+
+    free(list);
+    return error;
+}
+
+void tls_options_free(tls_options_t* opts)
+{
+    if (opts) {
+        free(opts->cafile);
+        opts->cafile = NULL;
+    }
+}
+
+/*************************************************************************************/
+
+static tls_session_entry_t* find_session(tls_context_t* ctx, const char* hostkey, bool create)
+{
+    tls_session_entry_t** bucket = &ctx->sessions[hash_string(hostkey) % TLS_SESSION_BUCKETS];
+    for (tls_session_entry_t* entry = *bucket; entry != NULL; entry = entry->next) {
+        if (0 == strcmp(entry->hostkey, hostkey)) {
+            return entry;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    tls_session_entry_t* entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        return NULL;
+    }
+
+    entry->hostkey = strdup(hostkey);
+    if (!entry->hostkey) {
+        free(entry);
+        return NULL;
+    }
+
+    entry->next = *bucket;
+    *bucket = entry;
+    return entry;
+}
+
+/*
+ * Server has given us a session, with TLS 1.3 this happens after handshake with the first read.
+ * Newest session replaces the one we had, returning 1 takes over the reference.
+ */
+static int on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    tls_conn_t* conn = SSL_get_app_data(ssl);
+
+    tls_session_entry_t* entry = find_session(conn->ctx, conn->hostkey, true);
+    if (!entry) {
+        return 0;
+    }
+
+    if (entry->session) {
+        SSL_SESSION_free(entry->session);
+    }
+
+    entry->session = session;
+    return 1;
+}
+
+/*
+ * Translate failed SSL call result to errno value and report real failures
+ */
+static int tls_error(tls_conn_t* conn, int res, const char* what)
+{
+    int ssl_error = SSL_get_error(conn->ssl, res);
+    switch (ssl_error)
+    {
+    case SSL_ERROR_WANT_READ:
+        conn->want_write = false;
+        return EAGAIN;
+
+    case SSL_ERROR_WANT_WRITE:
+        conn->want_write = true;
+        return EAGAIN;
+
+    case SSL_ERROR_SYSCALL: {
+        int error = (errno ? errno : ECONNRESET);
+        fprintf(stderr, "%s: TLS %s failed: %s\n", conn->hostkey, what, strerror(error));
+        return error;
+    }
+
+    default: {
+        long verify_result = SSL_get_verify_result(conn->ssl);
+        if (verify_result != X509_V_OK) {
+            fprintf(stderr, "%s: TLS %s failed: certificate verification failed: %s\n",
+                    conn->hostkey, what, X509_verify_cert_error_string(verify_result));
+        } else {
+            char buf[256];
+            ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+            fprintf(stderr, "%s: TLS %s failed: %s\n", conn->hostkey, what, buf);
+        }
+        return EPROTO;
+    }
+    }
+}
+
+/*************************************************************************************/
+
+int tls_init(const tls_options_t* opts, tls_context_t** out_ctx)
+{
+    int error = 0;
+
+    if (!opts || !out_ctx) {
+        return EINVAL;
+    }
+
+    tls_context_t* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        return ENOMEM;
+    }
+
+    ctx->opts = *opts;
+    ctx->opts.cafile = NULL;
+
+    ctx->ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx->ssl_ctx) {
+        fprintf(stderr, "Failed to create TLS context\n");
+        error = EPROTO;
+        goto error_out;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx->ssl_ctx, TLS1_2_VERSION);
+
+    // Replies are delimited by connection close, do not insist on close_notify
+    SSL_CTX_set_options(ctx->ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    SSL_CTX_set_mode(ctx->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (opts->ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ctx->ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+        fprintf(stderr, "kTLS is not supported by this OpenSSL version\n");
+#endif
+    }
+
+    if (opts->verify) {
+        SSL_CTX_set_verify(ctx->ssl_ctx, SSL_VERIFY_PEER, NULL);
+
+        int res = (opts->cafile ? SSL_CTX_load_verify_locations(ctx->ssl_ctx, opts->cafile, NULL)
+                                : SSL_CTX_set_default_verify_paths(ctx->ssl_ctx));
+        if (res != 1) {
+            fprintf(stderr, "Failed to load trusted certificates%s%s\n",
+                    (opts->cafile ? " from " : ""), (opts->cafile ? opts->cafile : ""));
+            error = EPROTO;
+            goto error_out;
+        }
+    }
+
+    // Sessions are kept per host by us, not by OpenSSL internal cache keyed by session id
+    if (opts->resume) {
+        SSL_CTX_set_session_cache_mode(ctx->ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx->ssl_ctx, on_new_session);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx->ssl_ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(ctx->ssl_ctx, SSL_OP_NO_TICKET);
+    }
+
+    *out_ctx = ctx;
+    return 0;
+
+error_out:
+    tls_free(ctx);
+    return error;
+}
+
+void tls_free(tls_context_t* ctx)
+{
+    if (ctx)
+    {
+        for (size_t i = 0; i < TLS_SESSION_BUCKETS; ++i) {
+            tls_session_entry_t* entry = ctx->sessions[i];
+            while (entry) {
+                tls_session_entry_t* next = entry->next;
+                if (entry->session) {
+                    SSL_SESSION_free(entry->session);
+                }
+                free(entry->hostkey);
+                free(entry);
+                entry = next;
+            }
+        }
+
+        if (ctx->ssl_ctx) {
+            SSL_CTX_free(ctx->ssl_ctx);
+        }
+
+        free(ctx);
+    }
+}
+
+int tls_connect(tls_context_t* ctx, int sockfd, const char* host, const char* hostkey, tls_conn_t** out_conn)
+{
+    int error = 0;
+
+    if (!ctx || sockfd < 0 || !host || !hostkey || !out_conn) {
+        return EINVAL;
+    }
+
+    tls_conn_t* conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        return ENOMEM;
+    }
+
+    conn->ctx = ctx;
+    conn->start_time = now_us();
+    conn->hostkey = strdup(hostkey);
+    conn->ssl = SSL_new(ctx->ssl_ctx);
+    if (!conn->hostkey || !conn->ssl) {
+        error = ENOMEM;
+        goto error_out;
+    }
+
+    SSL_set_app_data(conn->ssl, conn);
+
+    if (!SSL_set_fd(conn->ssl, sockfd)) {
+        error = EPROTO;
+        goto error_out;
+    }
+
+    // Server name indication is only for DNS names, addresses are checked against certificate IP entries
+    struct in6_addr addr;
+    bool is_address = (inet_pton(AF_INET, host, &addr) == 1) || (inet_pton(AF_INET6, host, &addr) == 1);
+    if (is_address) {
+        if (ctx->opts.verify && !X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(conn->ssl), host)) {
+            error = EPROTO;
+            goto error_out;
+        }
+    } else {
+        if (!SSL_set_tlsext_host_name(conn->ssl, host) || (ctx->opts.verify && !SSL_set1_host(conn->ssl, host))) {
+            error = EPROTO;
+            goto error_out;
+        }
+    }
+
+    if (ctx->opts.resume) {
+        tls_session_entry_t* entry = find_session(ctx, hostkey, false);
+        if (entry && entry->session && SSL_SESSION_is_resumable(entry->session)) {
+            SSL_set_session(conn->ssl, entry->session);
+        }
+    }
+
+    SSL_set_connect_state(conn->ssl);
+
+    *out_conn = conn;
+    return 0;
+
+error_out:
+    fprintf(stderr, "%s: Failed to set up TLS connection\n", hostkey);
+    tls_close(conn, false);
+    return error;
+}
+
+int tls_handshake(tls_conn_t* conn)
+{
+    assert(conn != NULL);
+
+    ERR_clear_error();
+    errno = 0;
+    int res = SSL_do_handshake(conn->ssl);
+    if (res != 1) {
+        return tls_error(conn, res, "handshake");
+    }
+
+    tls_context_t* ctx = conn->ctx;
+    conn->handshake_time = now_us() - conn->start_time;
+    conn->resumed = SSL_session_reused(conn->ssl);
+
+    if (conn->resumed) {
+        ++ctx->nresumed;
+        ctx->resumed_time += conn->handshake_time;
+    } else {
+        ++ctx->nfull;
+        ctx->full_time += conn->handshake_time;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (BIO_get_ktls_send(SSL_get_wbio(conn->ssl))) {
+        ++ctx->nktls_send;
+    }
+
+    if (BIO_get_ktls_recv(SSL_get_rbio(conn->ssl))) {
+        ++ctx->nktls_recv;
+    }
+#endif
+
+    return 0;
+}
+
+bool tls_want_write(const tls_conn_t* conn)
+{
+    return conn->want_write;
+}
+
+bool tls_eof(const tls_conn_t* conn)
+{
+    return conn->eof;
+}
+
+bool tls_resumed(const tls_conn_t* conn)
+{
+    return conn->resumed;
+}
+
+uint64_t tls_handshake_time(const tls_conn_t* conn)
+{
+    return conn->handshake_time;
+}
+
+ssize_t tls_send(tls_conn_t* conn, const void* buf, size_t len)
+{
+    ERR_clear_error();
+    errno = 0;
+    int res = SSL_write(conn->ssl, buf, (len > INT_MAX ? INT_MAX : len));
+    if (res > 0) {
+        return res;
+    }
+
+    errno = tls_error(conn, res, "send");
+    return -1;
+}
+
+/*
+ * Single SSL_read returns at most one record, keep reading while whole records fit in the buffer.
+ * Stopping at a record boundary means nothing is left decrypted inside SSL without socket being readable.
+ */
+ssize_t tls_recv(tls_conn_t* conn, void* buf, size_t len)
+{
+    if (conn->eof) {
+        return 0;
+    }
+
+    size_t total = 0;
+    while (total == 0 || len - total >= SSL3_RT_MAX_PLAIN_LENGTH)
+    {
+        ERR_clear_error();
+        errno = 0;
+        int res = SSL_read(conn->ssl, (char*)buf + total, (len - total > INT_MAX ? INT_MAX : len - total));
+        if (res > 0) {
+            total += res;
+            continue;
+        }
+
+        int ssl_error = SSL_get_error(conn->ssl, res);
+        if (ssl_error == SSL_ERROR_ZERO_RETURN) {
+            conn->eof = true;
+            break;
+        }
+
+        int error = tls_error(conn, res, "receive");
+        if (error == EAGAIN && total > 0) {
+            break;
+        }
+
+        errno = error;
+        return -1;
+    }
+
+    return total;
+}
+
+void tls_close(tls_conn_t* conn, bool clean)
+{
+    if (conn)
+    {
+        if (conn->ssl) {
+            // Without this OpenSSL takes the connection as aborted and marks its session not resumable
+            if (clean || conn->eof) {
+                SSL_set_shutdown(conn->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            }
+            SSL_free(conn->ssl);
+        }
+
+        free(conn->hostkey);
+        free(conn);
+    }
+}
+
+void tls_print_stats(const tls_context_t* ctx)
+{
+    assert(ctx != NULL);
+
+    if (ctx->nfull + ctx->nresumed == 0) {
+        return;
+    }
+
+    fprintf(stderr, "TLS handshakes: %zu full, average %.2f ms; %zu resumed, average %.2f ms\n",
+            ctx->nfull, (ctx->nfull ? ctx->full_time / 1000.0 / ctx->nfull : 0.0),
+            ctx->nresumed, (ctx->nresumed ? ctx->resumed_time / 1000.0 / ctx->nresumed : 0.0));
+
+    if (ctx->opts.ktls) {
+        fprintf(stderr, "kTLS: send offload on %zu, receive offload on %zu connections\n",
+                ctx->nktls_send, ctx->nktls_recv);
+    }
+}
+
+/*************************************************************************************/
@@ -0,0 +1,142 @@
+/**
+ * @file tls.h
+ *
+ * TLS client connections over non-blocking sockets with per host session resumption
+ */
+
+#ifndef _HTTPGET_TLS_H_
+#define _HTTPGET_TLS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   TLS options
+ */
+typedef struct tls_options
+{
+    bool verify;                    // Verify server certificate chain and host name
+    char* cafile;                   // Trusted certificates in PEM format, NULL for system default
+    bool resume;                    // Keep sessions per host and resume them on next connection
+    bool ktls;                      // Let kernel do record encryption when possible
+} tls_options_t;
+
+/**
+ * @brief   TLS client context shared by all connections
+ */
+typedef struct tls_context tls_context_t;
+
+/**
+ * @brief   Single TLS connection
+ */
+typedef struct tls_conn tls_conn_t;
+
+/**
+ * @brief       Init options with defaults: verify server, resume sessions, no kTLS.
+ */
+void tls_options_init(tls_options_t* opts);
+
+/**
+ * @brief       Parse TLS options specification: comma separated list of
+ *              insecure, cafile=<path>, noresume, ktls
+ *
+ * @returns     0 on success
+ *              EINVAL if specification contains unknown option
+ *              ENOMEM if there was no memory
+ */
+int tls_options_parse(tls_options_t* opts, const char* spec);
+
+/**
+ * @brief       Free all resources associated with these options.
+ */
+void tls_options_free(tls_options_t* opts);
+
+/**
+ * @brief       Create TLS client context.
+ *
+ * @out_ctx     On success will contain pointer to context.
+ *              Caller is responsible to free it using @tls_free@
+ *
+ * @returns     0 on success, EPROTO if OpenSSL failed to set up context, ENOMEM if there was no memory.
+ */
+int tls_init(const tls_options_t* opts, tls_context_t** out_ctx);
+
+/**
+ * @brief       Free context and all cached sessions.
+ */
+void tls_free(tls_context_t* ctx);
+
+/**
+ * @brief       Start TLS client on connected socket. Handshake is driven by @tls_handshake@.
+ *
+ * @host        Server name for SNI and certificate verification
+ * @hostkey     Session cache key, "host:port"
+ *
+ * @returns     0 on success, errno value on failure.
+ */
+int tls_connect(tls_context_t* ctx, int sockfd, const char* host, const char* hostkey, tls_conn_t** out_conn);
+
+/**
+ * @brief       Continue handshake.
+ *
+ * @returns     0 when handshake is complete,
+ *              EAGAIN if socket has to become ready first, see @tls_want_write@,
+ *              errno value on failure.
+ */
+int tls_handshake(tls_conn_t* conn);
+
+/**
+ * @brief       True if connection waits for socket to become writable rather than readable.
+ */
+bool tls_want_write(const tls_conn_t* conn);
+
+/**
+ * @brief       True if peer has finished sending. Peer may keep connection open after that,
+ *              so socket does not have to become readable again even though @tls_recv@ would return 0.
+ */
+bool tls_eof(const tls_conn_t* conn);
+
+/**
+ * @brief       True if last handshake resumed a cached session.
+ */
+bool tls_resumed(const tls_conn_t* conn);
+
+/**
+ * @brief       Handshake duration in microseconds.
+ */
+uint64_t tls_handshake_time(const tls_conn_t* conn);
+
+/**
+ * @brief       send() counterpart: returns bytes written or -1 with errno set, EAGAIN if socket is not ready.
+ */
+ssize_t tls_send(tls_conn_t* conn, const void* buf, size_t len);
+
+/**
+ * @brief       recv() counterpart: returns bytes read, 0 on end of stream or -1 with errno set.
+ */
+ssize_t tls_recv(tls_conn_t* conn, void* buf, size_t len);
+
+/**
+ * @brief       Free connection, socket is left to the caller.
+ *              No close_notify is sent, server closes connection after the reply anyway.
+ *
+ * @clean       Last reply was received in full, either up to Content-Length or up to close_notify.
+ *              Session stays resumable only for connections that ended cleanly.
+ */
+void tls_close(tls_conn_t* conn, bool clean);
+
+/**
+ * @brief       Print handshake counters and timings to stderr if there were any handshakes.
+ */
+void tls_print_stats(const tls_context_t* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include <pcre.h>
 
@@ -18,8 +19,8 @@
  * Regex string below is a modified version of the one found in RFC 2396 Appendix B
  * Modified to support optional scheme, username and password and also makes host field mandatory
  */
-//                                    012              34         5 6             7         8 9         AB        C   D        E F  
-static const char* g_url_regex_str = "^(([^:/?#]+)://)?(([^:/?#]*)(:([^/?#]*))?@)?([^:/?#]+)(:([\\d]+))?(([^?#]*)?(\\?([^#]*))?(#([^#]*))?)?$";
+//                                    012              34         5 6             7         8 9         ABC        D   E         F G
+static const char* g_url_regex_str = "^(([^:/?#]+)://)?(([^:/?#]*)(:([^/?#]*))?@)?([^:/?#]+)(:([\\d]+))?((([^?#]*)?(\\?([^#]*))?)(#([^#]*))?)?$";
 
 /*
  * Match string indexes for above url regex
@@ -32,11 +33,12 @@ enum
     URL_MATCH_HOST      = 7,
     URL_MATCH_PORT      = 9,
     URL_MATCH_FULLPATH  = 10,
-    URL_MATCH_PATH      = 11,
-    URL_MATCH_ARGS      = 13,
-    URL_MATCH_ANCHOR    = 15, 
+    URL_MATCH_TARGET    = 11,
+    URL_MATCH_PATH      = 12,
+    URL_MATCH_ARGS      = 14,
+    URL_MATCH_ANCHOR    = 16,
 
-    URL_MATCH_MAX       = 16
+    URL_MATCH_MAX       = 17
 };
 
 /*
@@ -180,6 +182,7 @@ int url_parse(url_parser_t* parser, const char* urlstr, url_t* out_url)
     get_nonempty_substring_or_die(urlstr, matchvec, nmatches, URL_MATCH_ANCHOR, &out_url->anchor);
     get_nonempty_substring_or_die(urlstr, matchvec, nmatches, URL_MATCH_PORT, &out_url->port);    
     get_nonempty_substring_or_die(urlstr, matchvec, nmatches, URL_MATCH_FULLPATH, &out_url->fullpath);
+    get_nonempty_substring_or_die(urlstr, matchvec, nmatches, URL_MATCH_TARGET, &out_url->target);
 
     #undef get_nonempty_substring_or_die
 
@@ -218,8 +221,270 @@ void url_free(url_t* url)
     url_free_kill_substring(url->anchor);
     url_free_kill_substring(url->port);
     url_free_kill_substring(url->fullpath);
+    url_free_kill_substring(url->target);
 
     #undef url_free_kill_substring
 }
 
 /*************************************************************************************/
+
+/*
+ * True if reference starts with scheme: ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ) ":"
+ */
+static int has_scheme(const char* reference)
+{
+    if (!isalpha((unsigned char)*reference)) {
+        return 0;
+    }
+
+    const char* p = reference + 1;
+    while (isalnum((unsigned char)*p) || *p == '+' || *p == '-' || *p == '.') {
+        ++p;
+    }
+
+    return (*p == ':');
+}
+
+/*
+ * Remove "." and ".." segments from absolute path in place, RFC 3986 section 5.2.4
+ */
+static void remove_dot_segments(char* path)
+{
+    const char* in = path;
+    size_t outlen = 0;
+
+    #define pop_segment()                                   \
+        while (outlen > 0 && path[--outlen] != '/') {       \
+        }                                                   \
+
+    while (*in)
+    {
+        if (0 == strncmp(in, "../", 3)) {
+            in += 3;
+        } else if (0 == strncmp(in, "./", 2) || 0 == strncmp(in, "/./", 3)) {
+            in += 2;
+        } else if (0 == strcmp(in, "/.")) {
+            path[outlen++] = '/';
+            break;
+        } else if (0 == strncmp(in, "/../", 4)) {
+            in += 3;
+            pop_segment();
+        } else if (0 == strcmp(in, "/..")) {
+            pop_segment();
+            path[outlen++] = '/';
+            break;
+        } else if (0 == strcmp(in, ".") || 0 == strcmp(in, "..")) {
+            break;
+        } else {
+            // Move first segment with its leading slash to output, output never gets ahead of input
+            do {
+                path[outlen++] = *in++;
+            } while (*in && *in != '/');
+        }
+    }
+
+    #undef pop_segment
+
+    path[outlen] = '\0';
+}
+
+int url_resolve(const url_t* base, const char* reference, char** out_urlstr)
+{
+    if (!base || !base->host || !reference || !out_urlstr) {
+        return EINVAL;
+    }
+
+    const char* scheme = (base->scheme ? base->scheme : "http");
+    char* urlstr = NULL;
+
+    if (has_scheme(reference)) {
+        size_t size = strlen(reference) + 1;
+        urlstr = malloc(size);
+        if (!urlstr) {
+            return ENOMEM;
+        }
+
+        memcpy(urlstr, reference, size);
+
+        *out_urlstr = urlstr;
+        return 0;
+    }
+
+    // Network path reference keeps only the scheme
+    if (reference[0] == '/' && reference[1] == '/') {
+        size_t size = strlen(scheme) + 1 + strlen(reference) + 1;
+        urlstr = malloc(size);
+        if (!urlstr) {
+            return ENOMEM;
+        }
+
+        snprintf(urlstr, size, "%s:%s", scheme, reference);
+        *out_urlstr = urlstr;
+        return 0;
+    }
+
+    // Path part of reference, query and fragment follow it as is
+    size_t pathlen = strcspn(reference, "?#");
+    const char* rest = reference + pathlen;
+    const char* basepath = (base->path ? base->path : "/");
+
+    char* path = malloc(strlen(basepath) + pathlen + 2);
+    if (!path) {
+        return ENOMEM;
+    }
+
+    const char* query = "";
+    if (pathlen == 0) {
+        // Same document, query is inherited unless reference has its own
+        strcpy(path, basepath);
+        if (*rest != '?' && base->args) {
+            query = base->args;
+        }
+    } else if (reference[0] == '/') {
+        memcpy(path, reference, pathlen);
+        path[pathlen] = '\0';
+    } else {
+        // Merge with everything up to the last slash of base path
+        size_t dirlen = strrchr(basepath, '/') - basepath + 1;
+        memcpy(path, basepath, dirlen);
+        memcpy(path + dirlen, reference, pathlen);
+        path[dirlen + pathlen] = '\0';
+    }
+
+    remove_dot_segments(path);
+
+    const char* format = "%s://%s%s%s%s%s%s%s";
+    #define resolve_args \
+        scheme, base->host, (base->port ? ":" : ""), (base->port ? base->port : ""), path, (*query ? "?" : ""), query, rest
+
+    size_t size = snprintf(NULL, 0, format, resolve_args) + 1;
+    urlstr = malloc(size);
+    if (urlstr) {
+        snprintf(urlstr, size, format, resolve_args);
+    }
+
+    #undef resolve_args
+
+    free(path);
+    if (!urlstr) {
+        return ENOMEM;
+    }
+
+    *out_urlstr = urlstr;
+    return 0;
+}
+
+/*
+ * Characters that mean the same whether percent-encoded or not, RFC 3986 section 2.3
+ */
+static int is_unreserved(int c)
+{
+    return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static int hex_value(int c)
+{
+    return (isdigit(c) ? c - '0' : toupper(c) - 'A' + 10);
+}
+
+/*
+ * Copy URL component normalizing its percent-encoding, output may be up to 3 times longer than input.
+ * Returns end of output.
+ */
+static char* normalize_escapes(char* out, const char* in)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    for (; *in; ++in)
+    {
+        unsigned char c = *in;
+        if (c == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+            int decoded = (hex_value((unsigned char)in[1]) << 4) | hex_value((unsigned char)in[2]);
+            if (is_unreserved(decoded)) {
+                *out++ = decoded;
+            } else {
+                *out++ = '%';
+                *out++ = toupper((unsigned char)in[1]);
+                *out++ = toupper((unsigned char)in[2]);
+            }
+            in += 2;
+        } else if (c <= 0x20 || c >= 0x7f || strchr("\"%<>\\^`{|}", c)) {
+            // Stray percent sign is taken literally
+            *out++ = '%';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+        } else {
+            *out++ = c;
+        }
+    }
+
+    *out = '\0';
+    return out;
+}
+
+int url_normalize(const url_t* url, char** out_urlstr)
+{
+    if (!url || !url->host || !out_urlstr) {
+        return EINVAL;
+    }
+
+    const char* scheme = (url->scheme ? url->scheme : "http");
+    const char* path = (url->path ? url->path : "/");
+
+    #define length_of(_str_)    ((_str_) ? strlen((_str_)) : 0)
+
+    size_t size = length_of(scheme) + 3 + length_of(url->username) + 1 + length_of(url->password) + 1 +
+                  length_of(url->host) + 1 + 3 * length_of(path) + 1 + 3 * length_of(url->args) + 1 + 24;
+
+    #undef length_of
+
+    char* urlstr = malloc(size);
+    if (!urlstr) {
+        return ENOMEM;
+    }
+
+    char* out = urlstr;
+    for (const char* p = scheme; *p; ++p) {
+        *out++ = tolower((unsigned char)*p);
+    }
+
+    out += sprintf(out, "://");
+
+    // Credentials are case sensitive and kept as is
+    if (url->username) {
+        out += sprintf(out, "%s%s%s@", url->username, (url->password ? ":" : ""), (url->password ? url->password : ""));
+    }
+
+    for (const char* p = url->host; *p; ++p) {
+        *out++ = tolower((unsigned char)*p);
+    }
+
+    if (url->port) {
+        unsigned long port = strtoul(url->port, NULL, 10);
+        unsigned long default_port = (0 == strncmp(urlstr, "https:", 6) ? 443 : (0 == strncmp(urlstr, "http:", 5) ? 80 : 0));
+        if (port != default_port) {
+            out += sprintf(out, ":%lu", port);
+        }
+    }
+
+    // Escapes are normalized first, encoded dot is still a dot segment
+    char* pathstart = out;
+    out = normalize_escapes(out, path);
+    remove_dot_segments(pathstart);
+    out = pathstart + strlen(pathstart);
+    if (out == pathstart) {
+        *out++ = '/';
+    }
+
+    if (url->args) {
+        *out++ = '?';
+        out = normalize_escapes(out, url->args);
+    }
+
+    *out = '\0';
+
+    *out_urlstr = urlstr;
+    return 0;
+}
+
+/*************************************************************************************/
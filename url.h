@@ -31,6 +31,7 @@ typedef struct url
     const char* anchor;
     const char* port;     
     const char* fullpath;   // path + args + anchor in one string
+    const char* target;     // path + args, request target never carries the anchor
 } url_t;
 
 /**
@@ -71,6 +72,38 @@ int url_parse(url_parser_t* parser, const char* string, url_t* out_url);
  */
 void url_free(url_t* url);
 
+/**
+ * @brief       Resolve URL reference, such as redirect Location, against base URL as described in RFC 3986 section 5.2.
+ *              Absolute references are returned as is, dot segments are removed from merged paths.
+ *              Missing base scheme is taken to be http.
+ *
+ * @base        Parsed URL reference is relative to
+ * @reference   Absolute URL, network path, absolute path or relative path with optional query and fragment
+ * @out_urlstr  On success will contain absolute URL string.
+ *              Caller is responsible to free it.
+ *
+ * @returns     0 on success
+ *              EINVAL if arguments are invalid
+ *              ENOMEM if there was no memory
+ */
+int url_resolve(const url_t* base, const char* reference, char** out_urlstr);
+
+/**
+ * @brief       Canonical form of URL, so that different spellings of the same resource compare equal:
+ *              lowercase scheme and host, no default port, "/" for empty path, no dot segments,
+ *              percent-encoded unreserved characters decoded, hex digits of other escapes in upper case,
+ *              characters not allowed in URLs percent-encoded, no fragment. Missing scheme is taken to be http.
+ *
+ * @url         Parsed URL
+ * @out_urlstr  On success will contain canonical URL string.
+ *              Caller is responsible to free it.
+ *
+ * @returns     0 on success
+ *              EINVAL if arguments are invalid
+ *              ENOMEM if there was no memory
+ */
+int url_normalize(const url_t* url, char** out_urlstr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,198 @@
+#include "urlset.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+/*************************************************************************************/
+
+#define URL_SET_MIN_SLOTS       1024
+#define URL_SET_MIN_ARENA       65536
+
+/*
+ * Open addressing table with linear probing. Slots hold only a hash and an offset of the string
+ * in a shared arena, 12 bytes per slot, so probing touches little memory and strings are compared
+ * only when full hashes match. Hash 0 marks an empty slot.
+ */
+struct url_set
+{
+    uint64_t* hashes;
+    uint32_t* offsets;
+    size_t nslots;                  // Power of two
+    size_t count;
+
+    char* arena;                    // NUL terminated strings back to back
+    size_t arena_length;
+    size_t arena_size;
+};
+
+/*************************************************************************************/
+
+/*
+ * Zero hash marks an empty slot
+ */
+static uint64_t hash_url(const char* urlstr)
+{
+    uint64_t hash = hash_string(urlstr);
+    return (hash ? hash : 1);
+}
+
+/*
+ * Slot URL is in or empty slot it would go to
+ */
+static size_t find_slot(const url_set_t* set, const char* urlstr, uint64_t hash)
+{
+    size_t mask = set->nslots - 1;
+    size_t slot = hash & mask;
+    while (set->hashes[slot] && !(set->hashes[slot] == hash && 0 == strcmp(set->arena + set->offsets[slot], urlstr))) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static int alloc_slots(url_set_t* set, size_t nslots)
+{
+    set->hashes = calloc(nslots, sizeof(*set->hashes));
+    set->offsets = malloc(nslots * sizeof(*set->offsets));
+    if (!set->hashes || !set->offsets) {
+        free(set->hashes);
+        free(set->offsets);
+        return ENOMEM;
+    }
+
+    set->nslots = nslots;
+    return 0;
+}
+
+/*
+ * Double the table, hashes are kept so strings are not touched
+ */
+static int grow_slots(url_set_t* set)
+{
+    uint64_t* hashes = set->hashes;
+    uint32_t* offsets = set->offsets;
+    size_t nslots = set->nslots;
+
+    int error = alloc_slots(set, nslots * 2);
+    if (error) {
+        set->hashes = hashes;
+        set->offsets = offsets;
+        return error;
+    }
+
+    size_t mask = set->nslots - 1;
+    for (size_t i = 0; i < nslots; ++i) {
+        if (hashes[i]) {
+            size_t slot = hashes[i] & mask;
+            while (set->hashes[slot]) {
+                slot = (slot + 1) & mask;
+            }
+
+            set->hashes[slot] = hashes[i];
+            set->offsets[slot] = offsets[i];
+        }
+    }
+
+    free(hashes);
+    free(offsets);
+    return 0;
+}
+
+/*************************************************************************************/
+
+int url_set_init(size_t expected, url_set_t** out_set)
+{
+    if (!out_set) {
+        return EINVAL;
+    }
+
+    url_set_t* set = calloc(1, sizeof(*set));
+    if (!set) {
+        return ENOMEM;
+    }
+
+    // Keep load under 70%
+    size_t nslots = URL_SET_MIN_SLOTS;
+    while (nslots * 7 < expected * 10) {
+        nslots *= 2;
+    }
+
+    if (alloc_slots(set, nslots)) {
+        free(set);
+        return ENOMEM;
+    }
+
+    *out_set = set;
+    return 0;
+}
+
+void url_set_free(url_set_t* set)
+{
+    if (set) {
+        free(set->hashes);
+        free(set->offsets);
+        free(set->arena);
+        free(set);
+    }
+}
+
+int url_set_add(url_set_t* set, const char* urlstr)
+{
+    if (!set || !urlstr) {
+        return EINVAL;
+    }
+
+    uint64_t hash = hash_url(urlstr);
+    size_t slot = find_slot(set, urlstr, hash);
+    if (set->hashes[slot]) {
+        return EEXIST;
+    }
+
+    size_t length = strlen(urlstr) + 1;
+    if (set->arena_length + length > UINT32_MAX) {
+        return ENOMEM;
+    }
+
+    if (set->arena_length + length > set->arena_size) {
+        size_t size = (set->arena_size ? set->arena_size : URL_SET_MIN_ARENA);
+        while (size < set->arena_length + length) {
+            size *= 2;
+        }
+
+        char* arena = realloc(set->arena, size);
+        if (!arena) {
+            return ENOMEM;
+        }
+
+        set->arena = arena;
+        set->arena_size = size;
+    }
+
+    if ((set->count + 1) * 10 > set->nslots * 7) {
+        int error = grow_slots(set);
+        if (error) {
+            return error;
+        }
+
+        slot = find_slot(set, urlstr, hash);
+    }
+
+    memcpy(set->arena + set->arena_length, urlstr, length);
+    set->hashes[slot] = hash;
+    set->offsets[slot] = set->arena_length;
+    set->arena_length += length;
+    ++set->count;
+    return 0;
+}
+
+size_t url_set_size(const url_set_t* set)
+{
+    assert(set != NULL);
+    return set->count;
+}
+
+/*************************************************************************************/
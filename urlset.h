@@ -0,0 +1,54 @@
+/**
+ * @file urlset.h
+ *
+ * Set of URL strings for deduplicating large batches
+ */
+
+#ifndef _HTTPGET_URLSET_H_
+#define _HTTPGET_URLSET_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   URL set opaque context
+ */
+typedef struct url_set url_set_t;
+
+/**
+ * @brief       Create empty set.
+ *
+ * @expected    Number of URLs set is sized for up front, it grows past that as needed
+ * @out_set     On success will contain pointer to set.
+ *              Caller is responsible to free it using @url_set_free@
+ *
+ * @returns     0 on success, ENOMEM if there was no memory.
+ */
+int url_set_init(size_t expected, url_set_t** out_set);
+
+/**
+ * @brief       Free all resources associated with this set.
+ */
+void url_set_free(url_set_t* set);
+
+/**
+ * @brief       Add URL to set unless it is there already. URL is compared as is, normalize it first.
+ *
+ * @returns     0 if URL was added
+ *              EEXIST if set already has this URL
+ *              ENOMEM if there was no memory
+ */
+int url_set_add(url_set_t* set, const char* urlstr);
+
+/**
+ * @brief       Number of URLs in set.
+ */
+size_t url_set_size(const url_set_t* set);
+
+#ifdef __cplusplus
+}
+#endif
+#endif